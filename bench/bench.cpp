@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+/* Benchmark runner for the solver variants.
+ * Every variant runs every puzzle of the corpus as a separate process.
+ * One JSON object per line is printed for each run and one summary line
+ * per variant:
+ *   wall_ms    - best wall time over the repeats
+ *   max_rss_kb - peak resident set of the child (getrusage)
+ *   nodes      - expressions created, from the "nodes: N" line the
+ *                variants print to stderr when COUNTDOWN_NODES is set
+ *   solutions  - stdout lines containing " = "
+ */
+
+// One line of the corpus: "<category> <target> <num1> ... <numN>"
+struct Puzzle {
+    string category;
+    vector<string> args;
+};
+
+// Result of one child process
+struct RunResult {
+    double wall_ms;
+    long max_rss_kb;
+    long nodes;
+    long solutions;
+    string status;
+};
+
+
+// Splits at whitespace
+vector<string> split(const string &text_){
+    vector<string> res;
+    istringstream in(text_);
+    string word;
+    while (in >> word) {
+        res.push_back(word);
+    }
+    return res;
+}
+
+string json_escape(const string &text_){
+    string res;
+    for(size_t i=0; i<text_.size(); ++i){
+        if (text_[i] == '"' || text_[i] == '\\') {
+            res += '\\';
+        }
+        res += text_[i];
+    }
+    return res;
+}
+
+double now_ms(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+
+bool load_corpus(const char *path_, vector<Puzzle> &puzzles_){
+    ifstream in(path_);
+    if (!in) {
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        vector<string> words(split(line));
+        if (words.size() < 3 || words[0][0] == '#') {
+            continue;
+        }
+        Puzzle p;
+        p.category = words[0];
+        p.args.assign(words.begin() + 1, words.end());
+        puzzles_.push_back(p);
+    }
+    return true;
+}
+
+
+// Runs command_ + puzzle args, counting solutions on stdout and reading
+// the node count from stderr. The child is killed after timeout_s_.
+RunResult run_once(const vector<string> &command_, const Puzzle &puzzle_, unsigned timeout_s_){
+    RunResult res = { 0, 0, -1, 0, "ok" };
+
+    int out_pipe[2], err_pipe[2];
+    if (pipe(out_pipe) < 0 || pipe(err_pipe) < 0) {
+        res.status = "pipe failed";
+        return res;
+    }
+
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(out_pipe[1], 1);
+        dup2(err_pipe[1], 2);
+        close(out_pipe[0]); close(out_pipe[1]);
+        close(err_pipe[0]); close(err_pipe[1]);
+
+        vector<char *> argv;
+        for(size_t i=0; i<command_.size(); ++i){
+            argv.push_back(const_cast<char *>(command_[i].c_str()));
+        }
+        for(size_t i=0; i<puzzle_.args.size(); ++i){
+            argv.push_back(const_cast<char *>(puzzle_.args[i].c_str()));
+        }
+        argv.push_back(NULL);
+
+        setenv("COUNTDOWN_NODES", "1", 1);
+        // The alarm survives exec and kills runaway children
+        alarm(timeout_s_);
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    // Drain both pipes, keeping only the tail of a partial stdout line
+    string out_tail, err_text;
+    struct pollfd fds[2] = { { out_pipe[0], POLLIN, 0 }, { err_pipe[0], POLLIN, 0 } };
+    int open_fds = 2;
+    char buf[1 << 16];
+    while (open_fds) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        for(int i=0; i<2; ++i){
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                --open_fds;
+                continue;
+            }
+            if (i == 1) {
+                err_text.append(buf, n);
+                continue;
+            }
+            out_tail.append(buf, n);
+            size_t line_start = 0, eol;
+            while ((eol = out_tail.find('\n', line_start)) != string::npos) {
+                if (out_tail.find(" = ", line_start) < eol) {
+                    ++res.solutions;
+                }
+                line_start = eol + 1;
+            }
+            out_tail.erase(0, line_start);
+        }
+    }
+
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    res.wall_ms = now_ms() - start;
+    res.max_rss_kb = usage.ru_maxrss;
+
+    if (WIFSIGNALED(status)) {
+        res.status = WTERMSIG(status) == SIGALRM ? "timeout" : "killed";
+    } else if (WEXITSTATUS(status) != 0) {
+        res.status = "exit " + to_string(WEXITSTATUS(status));
+    }
+
+    size_t pos = err_text.rfind("nodes: ");
+    if (pos != string::npos) {
+        res.nodes = atol(err_text.c_str() + pos + 7);
+    }
+    return res;
+}
+
+
+int main(int argc, char **argv) {
+
+    unsigned repeat = 1;
+    unsigned timeout_s = 60;
+    int arg = 1;
+    for(; arg<argc && argv[arg][0] == '-' && argv[arg][1] == '-'; ++arg) {
+        if (string(argv[arg]) == "--repeat" && arg + 1 < argc) {
+            repeat = max(1, atoi(argv[++arg]));
+        } else if (string(argv[arg]) == "--timeout" && arg + 1 < argc) {
+            timeout_s = atoi(argv[++arg]);
+        } else {
+            cerr << "Unknown option: " << argv[arg] << endl;
+            return 1;
+        }
+    }
+
+    if(argc - arg < 2) {
+        cerr << "Usage: bench/bench [--repeat N] [--timeout S] <corpus> <variant>..." << endl;
+        cerr << "       a variant is a binary path, with optional flags: \"./countdown --memo\"" << endl;
+        return 1;
+    }
+
+    vector<Puzzle> puzzles;
+    if (!load_corpus(argv[arg], puzzles)) {
+        cerr << "Cannot read corpus " << argv[arg] << endl;
+        return 1;
+    }
+
+    for(int v=arg+1; v<argc; ++v){
+        vector<string> command(split(argv[v]));
+        if (command.empty()) {
+            continue;
+        }
+        string name = json_escape(argv[v]);
+
+        double total_ms = 0;
+        long peak_rss = 0, total_nodes = 0, total_solutions = 0, failures = 0;
+
+        for(size_t p=0; p<puzzles.size(); ++p){
+            // Best of the repeats, the other numbers do not vary between runs
+            RunResult best = run_once(command, puzzles[p], timeout_s);
+            for(unsigned r=1; r<repeat && best.status == "ok"; ++r){
+                RunResult next = run_once(command, puzzles[p], timeout_s);
+                if (next.wall_ms < best.wall_ms) {
+                    best.wall_ms = next.wall_ms;
+                }
+            }
+
+            string puzzle_text;
+            for(size_t i=0; i<puzzles[p].args.size(); ++i){
+                puzzle_text += (i ? " " : "") + puzzles[p].args[i];
+            }
+            cout << "{\"variant\":\"" << name << "\""
+                 << ",\"category\":\"" << json_escape(puzzles[p].category) << "\""
+                 << ",\"puzzle\":\"" << puzzle_text << "\""
+                 << ",\"wall_ms\":" << best.wall_ms
+                 << ",\"max_rss_kb\":" << best.max_rss_kb
+                 << ",\"nodes\":" << best.nodes
+                 << ",\"solutions\":" << best.solutions
+                 << ",\"status\":\"" << best.status << "\"}" << endl;
+
+            total_ms += best.wall_ms;
+            peak_rss = max(peak_rss, best.max_rss_kb);
+            total_nodes += best.nodes > 0 ? best.nodes : 0;
+            total_solutions += best.solutions;
+            failures += best.status != "ok";
+        }
+
+        cout << "{\"variant\":\"" << name << "\",\"summary\":true"
+             << ",\"puzzles\":" << puzzles.size()
+             << ",\"wall_ms\":" << total_ms
+             << ",\"max_rss_kb\":" << peak_rss
+             << ",\"nodes\":" << total_nodes
+             << ",\"solutions\":" << total_solutions
+             << ",\"failures\":" << failures << "}" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+
+/* Load generator for "countdown --serve <socket>".
+ * Every connection sends one request at a time and waits for its answer,
+ * so the connections are the concurrency. Puzzles of the corpus are sent
+ * in turn until --requests have been answered. Prints one JSON object per
+ * category and one summary line:
+ *   requests        - answers received
+ *   p50_ms .. max_ms - latency from sending a request to its last line
+ *   throughput_rps  - answers per second of wall time (summary only)
+ *   solutions       - solution lines received
+ *   timeouts, busy, errors - answers of those kinds
+ */
+
+// One line of the corpus: "<category> <target> <num1> ... <numN>"
+struct Puzzle {
+    string category;
+    string text;
+};
+
+// One answered request
+struct Sample {
+    size_t puzzle;
+    double latency_ms;
+    long solutions;
+    string status;
+};
+
+
+double now_ms(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+bool load_corpus(const char *path_, vector<Puzzle> &puzzles_){
+    ifstream in(path_);
+    if (!in) {
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        istringstream words(line);
+        Puzzle p;
+        words >> p.category;
+        if (p.category.empty() || p.category[0] == '#') {
+            continue;
+        }
+        getline(words, p.text);
+        puzzles_.push_back(p);
+    }
+    return true;
+}
+
+int connect_to(const char *path_){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path_, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Line reader over a socket
+class LineReader {
+public:
+    explicit LineReader(int fd_): fd(fd_), begin(0) {}
+
+    // The next line without '\n', false once the connection ends
+    bool next(string &line_){
+        for(;;){
+            size_t eol = buffer.find('\n', begin);
+            if (eol != string::npos) {
+                line_.assign(buffer, begin, eol - begin);
+                begin = eol + 1;
+                return true;
+            }
+            buffer.erase(0, begin);
+            begin = 0;
+            char buf[1 << 16];
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            buffer.append(buf, n);
+        }
+    }
+
+private:
+    int fd;
+    size_t begin;
+    string buffer;
+};
+
+// Sends requests until next_ reaches requests_, collecting samples_
+void run_connection(const char *path_, const vector<Puzzle> &puzzles_, const string &mode_,
+                    unsigned deadline_ms_, long requests_, atomic<long> &next_,
+                    vector<Sample> &samples_, char &failed_){
+    int fd = connect_to(path_);
+    if (fd < 0) {
+        failed_ = true;
+        return;
+    }
+    LineReader reader(fd);
+    string line;
+    for(long i = next_++; i < requests_; i = next_++){
+        Sample sample = { size_t(i) % puzzles_.size(), 0, 0, "" };
+        string id = to_string(i);
+        string request = id + " " + mode_ + " " + to_string(deadline_ms_) + " " +
+                         puzzles_[sample.puzzle].text + "\n";
+        double start = now_ms();
+        if (write(fd, request.data(), request.size()) != ssize_t(request.size())) {
+            failed_ = true;
+            break;
+        }
+        // Solution lines until the status line of this id
+        while (sample.status.empty() && reader.next(line)) {
+            size_t tab = line.find('\t');
+            if (tab == string::npos || line.compare(0, tab, id)) {
+                continue;
+            }
+            if (line.find(" = ", tab) != string::npos) {
+                ++sample.solutions;
+            } else {
+                sample.status = line.substr(tab + 1, line.find(' ', tab) - tab - 1);
+            }
+        }
+        if (sample.status.empty()) {
+            failed_ = true;
+            break;
+        }
+        sample.latency_ms = now_ms() - start;
+        samples_.push_back(sample);
+    }
+    close(fd);
+}
+
+// Value below which fraction_ of the sorted latencies_ are
+double percentile(const vector<double> &latencies_, double fraction_){
+    if (latencies_.empty()) {
+        return 0;
+    }
+    size_t i = size_t(fraction_ * (latencies_.size() - 1) + 0.5);
+    return latencies_[i];
+}
+
+// JSON fields of samples_, without the braces
+string summarize(const vector<const Sample *> &samples_){
+    vector<double> latencies;
+    long solutions = 0, timeouts = 0, busy = 0, errors = 0;
+    for(size_t i=0; i<samples_.size(); ++i){
+        latencies.push_back(samples_[i]->latency_ms);
+        solutions += samples_[i]->solutions;
+        timeouts += samples_[i]->status == "timeout";
+        busy += samples_[i]->status == "busy";
+        errors += samples_[i]->status == "error";
+    }
+    sort(latencies.begin(), latencies.end());
+    ostringstream out;
+    out << "\"requests\":" << samples_.size()
+        << ",\"p50_ms\":" << percentile(latencies, 0.5)
+        << ",\"p90_ms\":" << percentile(latencies, 0.9)
+        << ",\"p99_ms\":" << percentile(latencies, 0.99)
+        << ",\"max_ms\":" << (latencies.empty() ? 0 : latencies.back())
+        << ",\"solutions\":" << solutions
+        << ",\"timeouts\":" << timeouts
+        << ",\"busy\":" << busy
+        << ",\"errors\":" << errors;
+    return out.str();
+}
+
+
+int main(int argc, char **argv) {
+
+    unsigned connections = 4;
+    long requests = 1000;
+    string mode = "all";
+    unsigned deadline_ms = 0;
+    int arg = 1;
+    for(; arg<argc && argv[arg][0] == '-' && argv[arg][1] == '-'; ++arg) {
+        if (string(argv[arg]) == "--connections" && arg + 1 < argc) {
+            connections = max(1, atoi(argv[++arg]));
+        } else if (string(argv[arg]) == "--requests" && arg + 1 < argc) {
+            requests = max(1, atoi(argv[++arg]));
+        } else if (string(argv[arg]) == "--mode" && arg + 1 < argc) {
+            mode = argv[++arg];
+        } else if (string(argv[arg]) == "--deadline" && arg + 1 < argc) {
+            deadline_ms = atoi(argv[++arg]);
+        } else {
+            cerr << "Unknown option: " << argv[arg] << endl;
+            return 1;
+        }
+    }
+
+    if(argc - arg != 2) {
+        cerr << "Usage: bench/loadgen [--connections N] [--requests N] [--mode all|first|closest]" << endl;
+        cerr << "                     [--deadline MS] <socket> <corpus>" << endl;
+        return 1;
+    }
+
+    vector<Puzzle> puzzles;
+    if (!load_corpus(argv[arg + 1], puzzles) || puzzles.empty()) {
+        cerr << "Cannot read corpus " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    atomic<long> next(0);
+    vector< vector<Sample> > samples(connections);
+    // vector<bool> packs bits, threads must not share its bytes
+    vector<char> failed(connections, false);
+    vector<thread> threads;
+    double start = now_ms();
+    for(unsigned c=0; c<connections; ++c){
+        threads.push_back(thread(run_connection, argv[arg], cref(puzzles), cref(mode), deadline_ms,
+                                 requests, ref(next), ref(samples[c]), ref(failed[c])));
+    }
+    for(size_t t=0; t<threads.size(); ++t){
+        threads[t].join();
+    }
+    double wall_ms = now_ms() - start;
+
+    vector<const Sample *> all;
+    map<string, vector<const Sample *> > categories;
+    for(unsigned c=0; c<connections; ++c){
+        if (failed[c]) {
+            cerr << "Connection " << c << " to " << argv[arg] << " failed" << endl;
+        }
+        for(size_t i=0; i<samples[c].size(); ++i){
+            all.push_back(&samples[c][i]);
+            categories[puzzles[samples[c][i].puzzle].category].push_back(&samples[c][i]);
+        }
+    }
+
+    for(map<string, vector<const Sample *> >::iterator it = categories.begin(); it != categories.end(); ++it){
+        cout << "{\"category\":\"" << it->first << "\"," << summarize(it->second) << "}" << endl;
+    }
+    cout << "{\"summary\":true,\"connections\":" << connections
+         << ",\"mode\":\"" << mode << "\",\"deadline_ms\":" << deadline_ms
+         << ",\"wall_ms\":" << wall_ms
+         << ",\"throughput_rps\":" << (wall_ms > 0 ? all.size() * 1000.0 / wall_ms : 0)
+         << "," << summarize(all) << "}" << endl;
+
+    return all.size() == size_t(requests) ? 0 : 1;
+}
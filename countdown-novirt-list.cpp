@@ -45,6 +45,9 @@ void init_operators(){
 }
 
 
+// Expressions created, reported for the benchmark runner
+unsigned long nodes_created = 0;
+
 // Complex expression - has left and right branches and an operator between them
 class ComplexExpression {
 public:
@@ -56,6 +59,7 @@ public:
         remaining_sources(numbers_list_)
     {
         value = op(lhs.get_value(), rhs.get_value() );
+        ++nodes_created;
     }
     ComplexExpression(int value_, list<int> numbers_list_):
         op(NULL),
@@ -63,7 +67,7 @@ public:
         rhs(*this),
         remaining_sources(numbers_list_),
         value(value_)
-    {}
+    {++nodes_created;}
 
     int get_value() {return value;}
     const list<int> &get_rem_sources() {return remaining_sources;}
@@ -209,6 +213,11 @@ int main(int argc, char **argv) {
 
     GenComplexExpressions(target, input_numbers, 0, 0);
 
+    // Node count for the benchmark runner
+    if (getenv("COUNTDOWN_NODES")) {
+        cerr << "nodes: " << nodes_created << endl;
+    }
+
     return 0;
 }
 
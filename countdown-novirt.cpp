@@ -1,9 +1,11 @@
 #include <stdlib.h>
+#include <limits.h>
 
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 using namespace std;
 
@@ -44,28 +46,93 @@ void init_operators(){
 }
 
 
+// Expressions created, reported for the benchmark runner
+unsigned long nodes_created = 0;
+
+// Bump allocator for expression nodes. Memory is handed out from big
+// chunks and released all at once by reset(); the chunks are kept, so
+// the next solve reuses them without touching the heap.
+class Arena {
+public:
+    Arena(): current(0), offset(0) {}
+    ~Arena(){
+        for(size_t i=0; i<chunks.size(); ++i){
+            free(chunks[i].memory);
+        }
+    }
+
+    void *allocate(size_t size_){
+        size_ = (size_ + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        while (current == chunks.size() || offset + size_ > chunks[current].size) {
+            if (current < chunks.size()) {
+                ++current;
+                offset = 0;
+                continue;
+            }
+            size_t size = size_ > CHUNK_SIZE ? size_ : CHUNK_SIZE;
+            Chunk c = { (char *)malloc(size), size };
+            chunks.push_back(c);
+            offset = 0;
+        }
+        void *res = chunks[current].memory + offset;
+        offset += size_;
+        return res;
+    }
+
+    // Release everything allocated since the last reset
+    void reset(){
+        current = 0;
+        offset = 0;
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    struct Chunk {
+        char *memory;
+        size_t size;
+    };
+
+    vector<Chunk> chunks;
+    size_t current;
+    size_t offset;
+
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+};
+
+inline void *operator new(size_t size_, Arena &arena_){
+    return arena_.allocate(size_);
+}
+inline void operator delete(void *, Arena &){}
+
+
 // Complex expression - has left and right branches and an operator between them
+// Nodes live in an Arena, remaining sources are an arena array shared with rhs
 class ComplexExpression {
 public:
-    ComplexExpression(operator_ptr_t op_, ComplexExpression &lhs_, ComplexExpression &rhs_,
-        vector<int> numbers_list_):
+    ComplexExpression(operator_ptr_t op_, ComplexExpression &lhs_, ComplexExpression &rhs_):
         op(op_),
         lhs(lhs_),
         rhs(rhs_),
-        remaining_sources(numbers_list_)
+        remaining_sources(rhs_.remaining_sources),
+        remaining_count(rhs_.remaining_count)
     {
         value = op(lhs.get_value(), rhs.get_value() );
+        ++nodes_created;
     }
-    ComplexExpression(const int value_, vector<int> numbers_list_):
+    ComplexExpression(const int value_, const int *numbers_list_, int numbers_count_):
         op(NULL),
         lhs(*this),
         rhs(*this),
         remaining_sources(numbers_list_),
+        remaining_count(numbers_count_),
         value(value_)
-    {}
+    {++nodes_created;}
 
     const int get_value() {return value;}
-    const vector<int> get_rem_sources() {return remaining_sources;}
+    const int *get_rem_sources() {return remaining_sources;}
+    int get_rem_count() {return remaining_count;}
     const string to_text() {
         if (&lhs == this) { return itos( value ); }
         else {
@@ -81,7 +148,8 @@ private:
     operator_ptr_t op;
     ComplexExpression &lhs;
     ComplexExpression &rhs;
-    vector<int> remaining_sources;
+    const int *remaining_sources;
+    int remaining_count;
     unsigned int value;
 
 };
@@ -98,22 +166,25 @@ inline void validate(int target, ComplexExpression *e){
  * target - target number
  * sources - list of numbers available
  * operators - list of operators to use
+ * count - number of sources
  * min_rem_sources - minimum number of numbers for the expression
  * counter - Converting generators to usual recursion needs internal
  *           flag to check recursion level. 
+ * arena - memory for the expressions, released by the caller
 */
 const vector<ComplexExpression *>
-GenComplexExpressions(int target_, const vector<int> &sources_,
-                      const int min_rem_sources_, const int counter_)
+GenComplexExpressions(int target_, const int *sources_, int count_,
+                      const int min_rem_sources_, const int counter_, Arena &arena_)
 {
 
     // Generates list of simple expressions from list of numbers
     vector<ComplexExpression *> simple_expr_list;
-    int max_size = sources_.size();
+    int max_size = count_;
     for(int i=0; i<max_size; ++i){
-        vector<int> temp(sources_);
-        temp.erase(temp.begin()+i);
-        ComplexExpression *res = new ComplexExpression(sources_[i], temp);
+        int *temp = (int *)arena_.allocate(sizeof(int) * (count_ - 1));
+        copy(sources_, sources_ + i, temp);
+        copy(sources_ + i + 1, sources_ + count_, temp + i);
+        ComplexExpression *res = new (arena_) ComplexExpression(sources_[i], temp, count_ - 1);
         simple_expr_list.insert(simple_expr_list.end(),res);
     }
 
@@ -125,18 +196,18 @@ GenComplexExpressions(int target_, const vector<int> &sources_,
     }else{
         for(int i=0; i<simple_expr_list.size(); ++i){
             validate(target_, simple_expr_list[i]);
-            delete simple_expr_list[i];
         }
     }
 
-    if(sources_.size() >= (min_rem_sources_+2) ) {
-        vector<ComplexExpression *> lhs_list( GenComplexExpressions(target_, sources_,
+    if(count_ >= (min_rem_sources_+2) ) {
+        vector<ComplexExpression *> lhs_list( GenComplexExpressions(target_, sources_, count_,
                                                              min_rem_sources_+1,
-                                                             counter_+1) );
+                                                             counter_+1, arena_) );
         int max_i = lhs_list.size();
         for(int i=0; i<max_i; ++i) {
             vector<ComplexExpression *> rhs_list( GenComplexExpressions(target_, lhs_list[i]->get_rem_sources(),
-                                                                        min_rem_sources_, counter_+1) );
+                                                                        lhs_list[i]->get_rem_count(),
+                                                                        min_rem_sources_, counter_+1, arena_) );
             int left = lhs_list[i]->get_value();
 
             int max_j = rhs_list.size();
@@ -153,8 +224,14 @@ GenComplexExpressions(int target_, const vector<int> &sources_,
                 map<operator_ptr_t, char>::iterator it;
                 for (it=operators.begin(); it != operators.end(); ++it){
                     
-                    // Avoid 1/3, only 3/1
-                    if( (it->first == divide) && !( (left/right)*right == left ) ) {
+                    // Avoid x/0 and 1/3, only 3/1
+                    if( (it->first == divide) && ( !right || (left/right)*right != left ) ) {
+                        continue;
+                    }
+
+                    // Avoid int overflow, left >= right >= 0 here
+                    if( ( it->first == add && left > INT_MAX - right ) ||
+                        ( it->first == mult && right && left > INT_MAX / right ) ) {
                         continue;
                     }
 
@@ -168,16 +245,14 @@ GenComplexExpressions(int target_, const vector<int> &sources_,
                         continue;
                     }
 
-                    ComplexExpression *res = new ComplexExpression( it->first,
-                                                                    *lhs_list[i],
-                                                                    *rhs_list[j],
-                                                                    rhs_list[j]->get_rem_sources() );
+                    ComplexExpression *res = new (arena_) ComplexExpression( it->first,
+                                                                             *lhs_list[i],
+                                                                             *rhs_list[j] );
                     
                     if(counter_){
                         expr_list.insert(expr_list.end(), res);
                     }else{
                         validate(target_, res);
-                        delete res;
                     }
                 }
             }
@@ -205,7 +280,15 @@ int main(int argc, char **argv) {
         input_numbers.push_back( atoi(argv[i]) );
     }
 
-    GenComplexExpressions(target, input_numbers, 0, 0);
+    // All nodes of the solve are released at once
+    Arena arena;
+    GenComplexExpressions(target, &input_numbers[0], input_numbers.size(), 0, 0, arena);
+    arena.reset();
+
+    // Node count for the benchmark runner
+    if (getenv("COUNTDOWN_NODES")) {
+        cerr << "nodes: " << nodes_created << endl;
+    }
 
     return 0;
 }
@@ -3,7 +3,6 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
-#include <map>
 
 using namespace std;
 
@@ -34,17 +33,19 @@ inline int divide(int left, int right){
 }
 
 
-// Map container for standard math operators
+// Table of standard math operators. It is constant, so the loop over it
+// can be unrolled and the calls inlined, and to_text reads the symbol
+// without a lookup.
 typedef int (*operator_ptr_t)(int,int);
-map<operator_ptr_t, char> operators;
-
-// Initialize map for operators
-void init_operators(){
-    operators[add] = '+';
-    operators[sub] = '-';
-    operators[mult] = '*';
-    operators[divide] = '/';
-}
+struct Operator {
+    operator_ptr_t apply;
+    char symbol;
+};
+const Operator operators[] = { {add, '+'}, {sub, '-'}, {mult, '*'}, {divide, '/'} };
+const int MAX_OPERATORS = sizeof(operators) / sizeof(operators[0]);
+
+// Expressions created, reported for the benchmark runner
+unsigned long nodes_created = 0;
 
 // Expression classes
 class Expression {
@@ -63,7 +64,7 @@ public:
     explicit SimpleExpression(const int value_, vector<int> numbers_list_):
         value(value_),
         remaining_sources(numbers_list_)
-    {++counter;}
+    {++counter; ++nodes_created;}
     
     const int get_value() {return value;}
     const vector<int> get_rem_sources() {return remaining_sources;}
@@ -81,15 +82,16 @@ private:
 // Complex expression - has left and right branches and an operator between them
 class ComplexExpression: public Expression {
 public:
-    explicit ComplexExpression(operator_ptr_t op_, Expression &lhs_, Expression &rhs_,
+    explicit ComplexExpression(const Operator &op_, Expression &lhs_, Expression &rhs_,
         vector<int> numbers_list_):
         op(op_),
         lhs(lhs_),
         rhs(rhs_),
         remaining_sources(numbers_list_)
     {
-        value = op(lhs.get_value(), rhs.get_value() );
+        value = op.apply(lhs.get_value(), rhs.get_value() );
         ++counter;
+        ++nodes_created;
     }
     ~ComplexExpression(){--counter;}
 
@@ -98,7 +100,7 @@ public:
     const string to_text() {
         return string("(" + \
                         lhs.to_text() + \
-                        operators[op] + \
+                        op.symbol + \
                         rhs.to_text() + \
                       ")");
     }
@@ -110,7 +112,7 @@ public:
     static int counter;
 
 private:
-    operator_ptr_t op;
+    const Operator &op;
     Expression &lhs;
     Expression &rhs;
     vector<int> remaining_sources;
@@ -148,14 +150,14 @@ GenSimpleExpressions(const vector<int> &sources_){
 /* Main function that generates math expressions
  * target - target number
  * sources - list of numbers available
- * operators - list of operators to use
+ * operators - table of operators to use
  * min_rem_sources - minimum number of numbers for the expression
  * counter - Converting generators to usual recursion needs internal
  *           flag to check recursion level. 
 */
 const vector<Expression *>
 GenComplexExpressions(int target_, const vector<int> &sources_,
-                      map<operator_ptr_t, char> &operators_,
+                      const Operator *operators_,
                       const int min_rem_sources_, const int counter_)
 {
     vector<Expression *> expr_list;
@@ -179,21 +181,20 @@ GenComplexExpressions(int target_, const vector<int> &sources_,
             vector<Expression *> rhs_list( GenComplexExpressions(target_, lhs_list[i]->get_rem_sources(),
                                                                  operators_, min_rem_sources_, counter_+1) );
             for(int j=0; j<rhs_list.size(); ++j){
-                map<operator_ptr_t, char>::iterator it;
                 // Optimization - avoid duplications like a+b,b+a or a*b,b*a.
                 // We only calculate variant with biggest left part
                 // Thus we also omit subtraction and division exceptions
                 if ( lhs_list[i]->get_value() < rhs_list[j]->get_value() ) {
                     continue;
                 }
-                for (it=operators.begin(); it != operators.end(); ++it){
+                for (int it=0; it < MAX_OPERATORS; ++it){
                     
                     // Optimization - a*1 or b/1 are valid expressions but redundant
-                    //if( ( rhs_list[j]->get_value() == 1 ) && (it->first == mult && it->first == divide) ){
+                    //if( ( rhs_list[j]->get_value() == 1 ) && (operators_[it].apply == mult && operators_[it].apply == divide) ){
                     //    continue;
                     //}
 
-                    ComplexExpression *res = new ComplexExpression( it->first,
+                    ComplexExpression *res = new ComplexExpression( operators_[it],
                                                                     *lhs_list[i],
                                                                     *rhs_list[j],
                                                                     rhs_list[j]->get_rem_sources() );
@@ -224,8 +225,6 @@ GenComplexExpressions(int target_, const vector<int> &sources_,
 
 int main(int argc, char **argv) {
 
-    init_operators();
-
     if(argc < 3) {
         cout << "Usage: ./countdown <target> <num1> <num2>...<numN>" << endl;
         exit(1);
@@ -243,6 +242,11 @@ int main(int argc, char **argv) {
     cerr << "SimpleExpression::counter: " << SimpleExpression::counter << endl;
     cerr << "ComplexExpression::counter: " << ComplexExpression::counter << endl;
 
+    // Node count for the benchmark runner
+    if (getenv("COUNTDOWN_NODES")) {
+        cerr << "nodes: " << nodes_created << endl;
+    }
+
     return 0;
 }
 
@@ -56,6 +56,9 @@ operator_ptr_t operators_list[] = {add, sub, mult, divide};
 char operators_char_list[] = {'+','-','*','/'};
 
 
+// Expressions created, reported for the benchmark runner
+unsigned long nodes_created = 0;
+
 // Expression - has left and right branches and an operator between them.
 class Expression {
 public:
@@ -67,6 +70,7 @@ public:
         remaining_sources(numbers_list_)
     {
         value = operators_list[op](lhs.get_value(), rhs.get_value() );
+        ++nodes_created;
     }
     Expression(uint32 value_, list<uint32> numbers_list_):
         op(0),
@@ -74,7 +78,7 @@ public:
         rhs(*this),
         remaining_sources(numbers_list_),
         value(value_)
-    {}
+    {++nodes_created;}
 
     const uint32 get_value() {return value;}
     const list<uint32> &get_rem_sources() {return remaining_sources;}
@@ -233,6 +237,11 @@ int main(int argc, char **argv) {
 
     GenExpressions(target, input_numbers, 0, 0);
 
+    // Node count for the benchmark runner
+    if (getenv("COUNTDOWN_NODES")) {
+        cerr << "nodes: " << nodes_created << endl;
+    }
+
     return 0;
 }
 
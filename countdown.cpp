@@ -1,221 +1,872 @@
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <iostream>
-#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <vector>
-#include <list>
-#include <map>
+#include <string>
+#include <thread>
+
+#include "countdown.h"
 
 using namespace std;
 
 
-typedef unsigned int uint32;
-typedef uint32 (*operator_ptr_t)(uint32,uint32);
-const int MAX_OPERATORS = 4;
+// Record formats of the output
+enum OutputFormat {
+    FORMAT_TEXT,    // "(25*4) = 100", batch lines prefixed with "id\t"
+    FORMAT_NDJSON   // {"puzzle":id,"expression":"(25*4)","value":100}
+};
 
+// Formats the solutions of the Solver callback as lines on stdout. In
+// batch mode lines carry the id of the puzzle being solved. With
+// count_only there is one line per puzzle with the number of solutions.
+// Lines are collected in a user-space buffer and written to stdout at the
+// end of every solve, or earlier once FLUSH_SIZE bytes are pending.
+class OutputWriter {
+public:
+    OutputWriter(): tagged(false), count_only(false), format(FORMAT_TEXT), puzzle_id(0) {}
 
-// Converter int -> string
-string itos(uint32 i)
-{
-    stringstream s;
-    s << i;
-    return s.str();
-}
+    void set_format(OutputFormat format_){
+        format = format_;
+    }
+
+    void set_count_only(bool count_only_){
+        count_only = count_only_;
+    }
+
+    void set_puzzle(uint32 puzzle_id_){
+        tagged = true;
+        puzzle_id = puzzle_id_;
+    }
+
+    // The Solver callback. Only the count is written with count_only.
+    void add(const char *expression_, size_t size_, uint32 value_){
+        if (count_only) {
+            return;
+        }
+        if (format == FORMAT_NDJSON) {
+            // Expressions are digits, brackets and operators only, so they
+            // need no escaping in JSON
+            append("{");
+            if (tagged) {
+                append("\"puzzle\":");
+                append_uint(puzzle_id);
+                append(",");
+            }
+            append("\"expression\":\"");
+            pending.append(expression_, size_);
+            append("\",\"value\":");
+            append_uint(value_);
+            append("}\n");
+        } else {
+            if (tagged) {
+                append_uint(puzzle_id);
+                append("\t");
+            }
+            pending.append(expression_, size_);
+            append(" = ");
+            append_uint(value_);
+            append("\n");
+        }
+        if (pending.size() >= FLUSH_SIZE) {
+            flush();
+        }
+    }
+
+    // Called after every solve
+    void end_puzzle(unsigned long solutions_){
+        if (count_only && format == FORMAT_NDJSON) {
+            append("{");
+            if (tagged) {
+                append("\"puzzle\":");
+                append_uint(puzzle_id);
+                append(",");
+            }
+            append("\"solutions\":");
+            append_uint(solutions_);
+            append("}\n");
+        } else if (count_only) {
+            if (tagged) {
+                append_uint(puzzle_id);
+                append("\t");
+            }
+            append_uint(solutions_);
+            append("\n");
+        }
+        flush();
+    }
+
+private:
+    static const size_t FLUSH_SIZE = 1 << 20;
+
+    // Writes the pending lines to stdout
+    void flush(){
+        const char *data = pending.data();
+        size_t size = pending.size();
+        while (size) {
+            ssize_t n = ::write(1, data, size);
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                break;
+            }
+            data += n;
+            size -= n;
+        }
+        pending.clear();
+    }
+
+    void append(const char *text_){
+        pending.append(text_);
+    }
+    // Converter int -> text, without a temporary string
+    void append_uint(unsigned long i){
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = '0' + i % 10;
+            i /= 10;
+        } while (i);
+        while (n) {
+            pending += digits[--n];
+        }
+    }
 
-// Functions-operators
-inline uint32 add(uint32 left, uint32 right){
-    return left + right;
+    bool tagged;
+    bool count_only;
+    OutputFormat format;
+    uint32 puzzle_id;
+    string pending;
+};
+
+
+// Reads the decimal digits at p_ into n_, advancing p_ past them.
+// Returns false when there are none or the value does not fit a uint32.
+bool ParseNumber(const char *&p_, const char *end_, uint32 &n_){
+    if (p_ == end_ || *p_ < '0' || *p_ > '9') {
+        return false;
+    }
+    unsigned long long n = 0;
+    for(; p_ != end_ && *p_ >= '0' && *p_ <= '9'; ++p_){
+        n = n * 10 + (*p_ - '0');
+        if (n > ~0u) {
+            return false;
+        }
+    }
+    n_ = n;
+    return true;
 }
-inline uint32 sub(uint32 left, uint32 right){
-    return left - right;
+
+
+// Reads "target n1 n2 ..." from [begin_, end_). Returns false on
+// malformed input or more numbers than fit the source bitmask.
+bool ParsePuzzle(const char *begin_, const char *end_, uint32 &target_, vector<uint32> &numbers_){
+    numbers_.clear();
+    bool has_target = false;
+    const char *p = begin_;
+    while (p != end_) {
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            ++p;
+            continue;
+        }
+        uint32 n;
+        if (!ParseNumber(p, end_, n)) {
+            return false;
+        }
+        if (has_target) {
+            numbers_.push_back(n);
+        } else {
+            target_ = n;
+            has_target = true;
+        }
+    }
+    return !numbers_.empty() && numbers_.size() <= 32;
 }
-inline uint32 mult(uint32 left, uint32 right){
-    return left * right;
+
+
+// The database of --db. Its answers are the one stored expression per
+// puzzle, or the stored one nearest to the target with closest.
+struct DatabaseQuery {
+    DatabaseQuery(): closest(false) {}
+
+    SolutionDatabase database;
+    bool closest;
+};
+
+// The database holds solutions of the standard game: exactly the four
+// operators and no cap on intermediate values. Other games are solved.
+bool DatabaseGame(const SolverOptions &options_){
+    string operators(options_.operators);
+    sort(operators.begin(), operators.end());
+    operators.erase(unique(operators.begin(), operators.end()), operators.end());
+    return operators == "*+-/" && options_.max_value == ~0u;
 }
-inline uint32 divide(uint32 left, uint32 right){
-    return left / right;
+
+// It stores one expression per puzzle, so it only answers searches for
+// one solution; all solutions are always solved
+bool DatabaseApplies(SearchMode mode_){
+    return mode_ == MODE_FIRST || mode_ == MODE_CLOSEST;
 }
 
+// Answers one puzzle from the database, false if it is not stored there
+bool Lookup(uint32 target_, const vector<uint32> &numbers_, const DatabaseQuery &query_,
+            OutputWriter &writer_){
+    string expression;
+    uint32 value = target_;
+    LookupResult res = query_.closest ?
+                       query_.database.lookup_closest(target_, numbers_, expression, value) :
+                       query_.database.lookup(target_, numbers_, expression);
+    if (res == LOOKUP_MISSING) {
+        return false;
+    }
+    if (res == LOOKUP_FOUND) {
+        writer_.add(expression.data(), expression.size(), value);
+    }
+    writer_.end_puzzle(res == LOOKUP_FOUND);
+    return true;
+}
 
-operator_ptr_t operators_list[] = {add, sub, mult, divide};
-char operators_char_list[] = {'+','-','*','/'};
+// Solves one puzzle, its output is written before the next one starts.
+// Puzzles in the database, if there is one, are looked up instead.
+void Solve(uint32 target_, const vector<uint32> &numbers_, Solver &solver_,
+           const DatabaseQuery *query_, OutputWriter &writer_){
+    if (query_ && Lookup(target_, numbers_, *query_, writer_)) {
+        return;
+    }
+    unsigned long solutions = solver_.solve(target_, numbers_,
+        [&writer_](const char *expression_, size_t size_, uint32 value_){
+            writer_.add(expression_, size_, value_);
+        });
+    writer_.end_puzzle(solutions);
+}
 
 
-// Expression - has left and right branches and an operator between them.
-class Expression {
-public:
-    Expression(int op_index_, Expression &lhs_, Expression &rhs_, list<uint32> numbers_list_):
-        op_index(op_index_),
-        lhs(lhs_),
-        rhs(rhs_),
-        remaining_sources(numbers_list_)
-    {
-        value = operators_list[op_index_](lhs.get_value(), rhs.get_value() );
+// Solves every puzzle line of [begin_, end_), output tagged with line numbers.
+// line_ is the number of lines before begin_. Empty lines and lines
+// starting with '#' are skipped.
+void SolveBatch(const char *begin_, const char *end_, uint32 &line_,
+                Solver &solver_, const DatabaseQuery *query_, OutputWriter &writer_){
+    uint32 target;
+    vector<uint32> numbers;
+    while (begin_ != end_) {
+        const char *eol = (const char *)memchr(begin_, '\n', end_ - begin_);
+        if (!eol) { eol = end_; }
+        ++line_;
+
+        const char *p = begin_;
+        while (p != eol && (*p == ' ' || *p == '\t' || *p == '\r')) { ++p; }
+        if (p != eol && *p != '#') {
+            if (ParsePuzzle(p, eol, target, numbers)) {
+                writer_.set_puzzle(line_);
+                Solve(target, numbers, solver_, query_, writer_);
+            } else {
+                cerr << "Skipping malformed puzzle on line " << line_ << endl;
+            }
+        }
+        begin_ = eol == end_ ? end_ : eol + 1;
     }
-    Expression(uint32 value_, list<uint32> numbers_list_):
-        op_index(-1),
-        lhs(*this),
-        rhs(*this),
-        remaining_sources(numbers_list_),
-        value(value_)
-    {}
+}
+
 
-    const uint32 get_value() {return value;}
-    const list<uint32> &get_rem_sources() {return remaining_sources;}
-    const string to_text() {
-        if (&lhs == this) { return itos( value ); }
-        else {
-            return string("(" + \
-                            lhs.to_text() + \
-                            operators_char_list[op_index] + \
-                            rhs.to_text() + \
-                          ")");
+/* Server mode: requests are lines on a Unix domain socket, or on stdin
+ * with the answers on stdout.
+ *   <id> <mode> <deadline_ms> <target> <num1> ... <numN>
+ * mode is all, first or closest, a deadline_ms of 0 is none. The id is
+ * any word and tags every line of the answer:
+ *   <id>\t<expression> = <value>   a solution, as in batch mode
+ *   <id>\tdone <solutions>         the end of the answer
+ *   <id>\ttimeout <solutions>      the end, after the deadline: the search
+ *                                  was cancelled and may be incomplete
+ *   <id>\tbusy                     the queue is full, nothing was solved
+ *   <id>\terror <message>
+ * Answers of one connection come in the order they are done. The lines of
+ * one answer are written together, except that an answer of more than
+ * 1 MiB is sent in blocks while it is solved, and lines of other answers
+ * can come between those blocks. Workers own one warm Solver per mode and
+ * take requests from a bounded queue. A socket request that finds the
+ * queue full is answered busy; on stdin reading waits for room instead,
+ * so a file of requests can be piped in. Deadlines count from when the
+ * request is read; a watchdog cancels solves that run past theirs.
+ */
+
+typedef chrono::steady_clock Clock;
+
+// Both ends of a client: a socket, or stdin and stdout
+struct Connection {
+    Connection(int in_fd_, int out_fd_, bool owns_fds_):
+        in_fd(in_fd_), out_fd(out_fd_), owns_fds(owns_fds_) {}
+    ~Connection(){
+        if (owns_fds) {
+            close(in_fd);
         }
     }
 
-private:
-    int op_index;
-    Expression &lhs;
-    Expression &rhs;
-    list<uint32> remaining_sources;
-    uint32 value;
+    // Writes text_ whole, answers of several workers do not mix. Errors
+    // are ignored, the reader sees the connection end.
+    void send(const string &text_){
+        lock_guard<mutex> guard(write_lock);
+        const char *data = text_.data();
+        size_t size = text_.size();
+        while (size) {
+            ssize_t n = ::write(out_fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                break;
+            }
+            data += n;
+            size -= n;
+        }
+    }
 
+    int in_fd;
+    int out_fd;
+    bool owns_fds;
+    mutex write_lock;
 };
 
+struct ServerRequest {
+    shared_ptr<Connection> connection;
+    string id;
+    SearchMode mode;
+    uint32 target;
+    vector<uint32> numbers;
+    bool has_deadline;
+    Clock::time_point deadline;
+};
 
-// simple comparing of target to expression value
-inline void compare(uint32 target, Expression *e){
-    if (e->get_value() == target)
-        cout << e->to_text() << " = " << target << endl;
+// Reads the word at p_ into word_, returns the end of it
+const char *next_word(const char *p_, const char *end_, string &word_){
+    while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r')) { ++p_; }
+    const char *begin = p_;
+    while (p_ != end_ && *p_ != ' ' && *p_ != '\t' && *p_ != '\r') { ++p_; }
+    word_.assign(begin, p_);
+    return p_;
 }
 
-// Validate the input numbers
-inline bool validate(operator_ptr_t op, uint32 left, uint32 right){
+class Server {
+public:
+    Server(const SolverOptions &options_, uint32 workers_, size_t queue_size_,
+           const SolutionDatabase *database_):
+        queue_size(queue_size_), count_only(options_.count_only), database(database_),
+        cache(options_.cache_bytes),
+        in_flight(0), quit(false), workers(workers_)
+    {
+        // One cache for all solvers, --cache is the cap of the server
+        SolverOptions options(options_);
+        if (options.cache_bytes) {
+            options.cache = &cache;
+        }
+        for(size_t w=0; w<workers.size(); ++w){
+            for(int m=0; m<3; ++m){
+                options.mode = SearchMode(m);
+                workers[w].solvers[m] = new Solver(options);
+            }
+            workers[w].active = NULL;
+        }
+        for(size_t w=0; w<workers.size(); ++w){
+            threads.push_back(thread(&Server::work, this, w));
+        }
+        threads.push_back(thread(&Server::watch, this));
+    }
 
-    // Avoid 1/3, only 3/1
-    if( (op == divide) && (left % right) ) {
-        return false;
+    ~Server(){
+        {
+            lock_guard<mutex> guard(lock);
+            quit = true;
+        }
+        queued.notify_all();
+        dequeued.notify_all();
+        watched.notify_all();
+        for(size_t t=0; t<threads.size(); ++t){
+            threads[t].join();
+        }
+        for(size_t w=0; w<workers.size(); ++w){
+            for(int m=0; m<3; ++m){
+                delete workers[w].solvers[m];
+            }
+        }
     }
 
-    // Optimization - a*1 or b/1 are valid expressions but redundant
-    if( ( right == 1 ) && (op == mult || op == divide) ) {
-        return false;
+    // Queues the requests of connection_ until it ends. With wait_ a full
+    // queue blocks the reader, otherwise the request is answered busy.
+    void read_requests(shared_ptr<Connection> connection_, bool wait_){
+        char buf[1 << 16];
+        string input;
+        for(;;){
+            ssize_t n = ::read(connection_->in_fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            input.append(buf, n);
+            size_t begin = 0, eol;
+            while ((eol = input.find('\n', begin)) != string::npos) {
+                add_request(connection_, input.data() + begin, input.data() + eol, wait_);
+                begin = eol + 1;
+            }
+            input.erase(0, begin);
+        }
+        if (!input.empty()) {
+            add_request(connection_, input.data(), input.data() + input.size(), wait_);
+        }
     }
 
-    // Avoid a-b=0
-    if( ( op == sub ) && ( left == right ) ) {
-        return false;
+    // Waits until every request queued so far is answered
+    void drain(){
+        unique_lock<mutex> guard(lock);
+        while (in_flight) {
+            idle.wait(guard);
+        }
     }
 
-    return true;
-}
+private:
+    struct Worker {
+        Solver *solvers[3];
+        // The solver of the request being solved, NULL when idle
+        Solver *active;
+        bool has_deadline;
+        Clock::time_point deadline;
+    };
+
+    // Parses one request line and queues it, or answers it right away
+    void add_request(const shared_ptr<Connection> &connection_, const char *begin_, const char *end_,
+                     bool wait_){
+        ServerRequest request;
+        string mode, deadline;
+        const char *p = next_word(begin_, end_, request.id);
+        if (request.id.empty() || request.id[0] == '#') {
+            return;
+        }
+        p = next_word(p, end_, mode);
+        p = next_word(p, end_, deadline);
+        if (mode == "all") {
+            request.mode = MODE_ALL;
+        } else if (mode == "first") {
+            request.mode = MODE_FIRST;
+        } else if (mode == "closest") {
+            request.mode = MODE_CLOSEST;
+        } else {
+            connection_->send(request.id + "\terror unknown mode\n");
+            return;
+        }
+        char *deadline_end;
+        unsigned long deadline_ms = strtoul(deadline.c_str(), &deadline_end, 10);
+        if (deadline.empty() || *deadline_end || !ParsePuzzle(p, end_, request.target, request.numbers)) {
+            connection_->send(request.id + "\terror malformed request\n");
+            return;
+        }
+        request.connection = connection_;
+        request.has_deadline = deadline_ms != 0;
+        request.deadline = Clock::now() + chrono::milliseconds(deadline_ms);
+
+        {
+            unique_lock<mutex> guard(lock);
+            while (wait_ && pending.size() >= queue_size && !quit) {
+                dequeued.wait(guard);
+            }
+            if (pending.size() < queue_size) {
+                pending.push_back(request);
+                ++in_flight;
+                queued.notify_one();
+                return;
+            }
+        }
+        connection_->send(request.id + "\tbusy\n");
+    }
+
+    // Solves queued requests until the server quits
+    void work(uint32 worker_){
+        Worker &worker = workers[worker_];
+        string answer;
+        for(;;){
+            unique_lock<mutex> guard(lock);
+            while (pending.empty() && !quit) {
+                queued.wait(guard);
+            }
+            if (pending.empty()) {
+                return;
+            }
+            ServerRequest request = pending.front();
+            pending.pop_front();
+            dequeued.notify_one();
+            worker.active = worker.solvers[request.mode];
+            worker.has_deadline = request.has_deadline;
+            worker.deadline = request.deadline;
+            guard.unlock();
+            watched.notify_one();
+
+            answer.clear();
+            unsigned long solutions = answer_request(request, *worker.active, answer);
+            bool late = request.has_deadline && Clock::now() >= request.deadline;
+            answer += request.id;
+            answer += late ? "\ttimeout " : "\tdone ";
+            answer += to_string(solutions);
+            answer += '\n';
+            request.connection->send(answer);
+
+            guard.lock();
+            worker.active = NULL;
+            if (!--in_flight) {
+                idle.notify_all();
+            }
+        }
+    }
 
+    // Solves request_ with solver_, or looks it up in the database for
+    // first and closest. The solution lines go to answer_, which is sent
+    // early once it is big.
+    unsigned long answer_request(const ServerRequest &request_, Solver &solver_, string &answer_){
+        if (request_.has_deadline && Clock::now() >= request_.deadline) {
+            return 0;
+        }
+        if (database && DatabaseApplies(request_.mode)) {
+            string expression;
+            uint32 value = request_.target;
+            LookupResult res = request_.mode == MODE_CLOSEST ?
+                database->lookup_closest(request_.target, request_.numbers, expression, value) :
+                database->lookup(request_.target, request_.numbers, expression);
+            if (res == LOOKUP_FOUND && !count_only) {
+                answer_ += request_.id + "\t" + expression + " = " + to_string(value) + "\n";
+            }
+            if (res != LOOKUP_MISSING) {
+                return res == LOOKUP_FOUND;
+            }
+        }
+        return solver_.solve(request_.target, request_.numbers,
+            [&](const char *expression_, size_t size_, uint32 value_){
+                answer_ += request_.id;
+                answer_ += '\t';
+                answer_.append(expression_, size_);
+                answer_ += " = ";
+                answer_ += to_string(value_);
+                answer_ += '\n';
+                if (answer_.size() >= (1 << 20)) {
+                    request_.connection->send(answer_);
+                    answer_.clear();
+                }
+            });
+    }
 
-/* Main function that generates math expressions recursively
- * target - target number
- * sources - list of numbers available
- * min_rem_sources - minimum number of numbers for the expression
- * counter - Converting generators to usual recursion needs internal
- *           flag to check recursion level. 
-*/
-const list<Expression *>
-GenExpressions(uint32 target_, const list<uint32> &sources_,
-                      uint32 min_rem_sources_, uint32 counter_)
-{
-
-    // Generates list of simple expressions from list of numbers
-    vector<Expression *> simple_expr_list;
-    int max_size = sources_.size();
-    list<uint32>::const_iterator it = sources_.begin();
-    for(int i=0; i<max_size; ++i, ++it){
-        vector<uint32> temp(sources_.begin(), sources_.end());
-        temp.erase(temp.begin()+i);
-        Expression *res = new Expression((uint32)*it, list<uint32>(temp.begin(), temp.end()));
-        simple_expr_list.push_back(res);
-    }
-
-    list<Expression *> expr_list;
-
-    // If we are inside more than one call level then add simple
-    // expressions to the full list
-    if(counter_){
-        // Extend list
-        expr_list.insert(expr_list.end(), simple_expr_list.begin(), simple_expr_list.end() );
-    // We are in the outer function call, we only nedd to compare our expressions to target
-    }else{
-        int max_size = simple_expr_list.size();
-        for(int i=0; i<max_size; ++i){
-            compare(target_, simple_expr_list[i]);
-            delete simple_expr_list[i];
-        }
-    }
-
-    if(sources_.size() >= (min_rem_sources_+2) ) {
-        list<Expression *> lhs_list( GenExpressions(target_, sources_,
-                                                    min_rem_sources_+1, counter_+1) );
-
-        // Two loops for left and right branches of expression
-        list<Expression *>::iterator lhs_it;
-        for(lhs_it=lhs_list.begin(); lhs_it != lhs_list.end(); ++lhs_it) {
-            list<Expression *> rhs_list( GenExpressions(target_, (*lhs_it)->get_rem_sources(),
-                                                        min_rem_sources_, counter_+1) );
-            uint32 left = (*lhs_it)->get_value();
-
-            list<Expression *>::iterator rhs_it;
-            for(rhs_it=rhs_list.begin(); rhs_it != rhs_list.end(); ++rhs_it){
-                uint32 right = (*rhs_it)->get_value();
-
-                // Optimization - avoid duplications like a+b,b+a or a*b,b*a.
-                // We only calculate variant with biggest left part
-                // Thus we also omit subtraction and division exceptions
-                if ( left < right ) {
+    // Cancels the solves past their deadline. A cancel that comes before
+    // the solve has started is lost, so it is repeated until the worker
+    // is done.
+    void watch(){
+        unique_lock<mutex> guard(lock);
+        while (!quit) {
+            Clock::time_point now = Clock::now();
+            Clock::time_point next = now + chrono::hours(1);
+            for(size_t w=0; w<workers.size(); ++w){
+                if (!workers[w].active || !workers[w].has_deadline) {
                     continue;
                 }
-
-                operator_ptr_t op;
-                // Iterating through the list of math operators
-                for (int it=0; it < MAX_OPERATORS; ++it){
-                    op = operators_list[it];
-                    
-                    if (!validate(op, left, right)) {
-                        continue;
-                    }
-
-                    // Create new 100% valid expression
-                    Expression *res = new Expression( it, **lhs_it, **rhs_it,
-                                                      (*rhs_it)->get_rem_sources() );
-                    
-                    if(counter_){
-                        expr_list.push_back(res);
-                    }else{
-                        compare(target_, res);
-                        delete res;
-                    }
+                if (workers[w].deadline <= now) {
+                    workers[w].active->cancel();
+                    next = min(next, now + chrono::milliseconds(1));
+                } else {
+                    next = min(next, workers[w].deadline);
                 }
             }
+            watched.wait_until(guard, next);
         }
     }
 
-    return expr_list;
+    size_t queue_size;
+    bool count_only;
+    const SolutionDatabase *database;
+    SolverCache cache;
+
+    // Guards everything below
+    mutex lock;
+    deque<ServerRequest> pending;
+    // Queued or being solved
+    size_t in_flight;
+    bool quit;
+    vector<Worker> workers;
+    condition_variable queued;
+    condition_variable dequeued;
+    condition_variable watched;
+    condition_variable idle;
+
+    vector<thread> threads;
+};
+
+// Serves the clients of the Unix socket at path_, one reader thread each.
+// Only returns if the socket cannot be set up.
+void ServeSocket(const char *path_, Server &server_){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path_) >= sizeof(address.sun_path)) {
+        cerr << "Socket path too long: " << path_ << endl;
+        return;
+    }
+    strcpy(address.sun_path, path_);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path_);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 64) < 0) {
+        cerr << "Cannot listen on " << path_ << ": " << strerror(errno) << endl;
+        return;
+    }
+    for(;;){
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            cerr << "Cannot accept on " << path_ << ": " << strerror(errno) << endl;
+            return;
+        }
+        shared_ptr<Connection> connection(new Connection(client, client, true));
+        thread(&Server::read_requests, &server_, connection, false).detach();
+    }
+}
+
+
+// Keys of the prune counts in the --stats JSON, by PruneRule
+const char *const PRUNE_RULE_NAMES[PRUNE_RULES] = {
+    "left_lt_right", "identity", "absorbing", "domain", "canonical", "shared"
+};
+
+// SearchStats as one JSON object on stderr. The generation time is the
+// part of the search that is not combining or rendering.
+void PrintStats(const SearchStats &stats_){
+    cerr << "{\"nodes\":" << stats_.nodes << ",\"depth_nodes\":[";
+    for(size_t d=0; d<stats_.depth_nodes.size(); ++d){
+        cerr << (d ? "," : "") << stats_.depth_nodes[d];
+    }
+    cerr << "],\"pruned\":{";
+    for(int r=0; r<PRUNE_RULES; ++r){
+        cerr << (r ? "," : "") << "\"" << PRUNE_RULE_NAMES[r] << "\":" << stats_.pruned[r];
+    }
+    double generate = stats_.search_seconds - stats_.combine_seconds - stats_.render_seconds;
+    cerr << "},\"matches\":" << stats_.matches
+         << ",\"seconds\":{\"total\":" << stats_.seconds
+         << ",\"search\":" << stats_.search_seconds
+         << ",\"generate\":" << max(generate, 0.0)
+         << ",\"combine\":" << stats_.combine_seconds
+         << ",\"render\":" << stats_.render_seconds << "}}" << endl;
+}
+
+// Node count for the benchmark runner, how the cache did and --stats
+void ReportNodes(const Solver &solver_, const SolverOptions &options_){
+    if (getenv("COUNTDOWN_NODES")) {
+        cerr << "nodes: " << solver_.nodes() << endl;
+    }
+    if (options_.cache_bytes) {
+        cerr << "cache hits: " << solver_.cache_hits()
+             << " misses: " << solver_.cache_misses() << endl;
+    }
+    if (options_.stats) {
+        PrintStats(solver_.stats());
+    }
 }
 
 
 int main(int argc, char **argv) {
 
-    if(argc < 3) {
-        cerr << "Usage: ./countdown <target> <num1> <num2>...<numN>" << endl;
+    // Optional flags go before the target
+    SolverOptions options;
+    bool batch = false;
+    bool serve = false;
+    uint32 serve_workers = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+    size_t serve_queue = 64;
+    OutputFormat format = FORMAT_TEXT;
+    const char *build_db = NULL;
+    const char *db = NULL;
+    int arg = 1;
+    for(; arg<argc && argv[arg][0] == '-' && argv[arg][1] == '-'; ++arg) {
+        if (string(argv[arg]) == "--memo") {
+            options.algorithm = ALGO_MEMO;
+        } else if (string(argv[arg]) == "--mitm") {
+            options.algorithm = ALGO_MITM;
+        } else if (string(argv[arg]) == "--stream") {
+            options.algorithm = ALGO_STREAM;
+        } else if (string(argv[arg]) == "--batch") {
+            batch = true;
+        } else if (string(argv[arg]) == "--serve") {
+            serve = true;
+        } else if (string(argv[arg]) == "--workers" && arg + 1 < argc) {
+            serve_workers = max(1, atoi(argv[++arg]));
+        } else if (string(argv[arg]) == "--queue" && arg + 1 < argc) {
+            serve_queue = max(1, atoi(argv[++arg]));
+        } else if (string(argv[arg]) == "--closest") {
+            options.mode = MODE_CLOSEST;
+        } else if (string(argv[arg]) == "--first") {
+            options.mode = MODE_FIRST;
+        } else if (string(argv[arg]) == "--distinct") {
+            options.distinct = true;
+        } else if (string(argv[arg]) == "--hash-cons") {
+            options.hash_cons = true;
+        } else if (string(argv[arg]) == "--max-intermediate" && arg + 1 < argc) {
+            options.max_value = strtoul(argv[++arg], NULL, 10);
+        } else if (string(argv[arg]) == "--operators" && arg + 1 < argc) {
+            options.operators = argv[++arg];
+            size_t bad = options.operators.find_first_not_of(OPERATOR_SYMBOLS);
+            if (options.operators.empty() || bad != string::npos) {
+                cerr << "Unknown operators: " << options.operators
+                     << ", known are " << OPERATOR_SYMBOLS << endl;
+                return 1;
+            }
+        } else if (string(argv[arg]) == "--build-db" && arg + 1 < argc) {
+            build_db = argv[++arg];
+        } else if (string(argv[arg]) == "--cache" && arg + 1 < argc) {
+            // In megabytes
+            options.cache_bytes = size_t(strtoul(argv[++arg], NULL, 10)) << 20;
+        } else if (string(argv[arg]) == "--db" && arg + 1 < argc) {
+            db = argv[++arg];
+        } else if (string(argv[arg]) == "--stats") {
+            options.stats = true;
+        } else if (string(argv[arg]) == "--count") {
+            options.count_only = true;
+        } else if (string(argv[arg]) == "--format" && arg + 1 < argc) {
+            string name = argv[++arg];
+            if (name == "ndjson") {
+                format = FORMAT_NDJSON;
+            } else if (name != "text") {
+                cerr << "Unknown format: " << name << endl;
+                return 1;
+            }
+        } else if (string(argv[arg]) == "--threads" && arg + 1 < argc) {
+            options.threads = atoi(argv[++arg]);
+            if (options.threads == 0) {
+                options.threads = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+            }
+        } else {
+            cerr << "Unknown option: " << argv[arg] << endl;
+            return 1;
+        }
+    }
+
+    // Solves every standard draw, nothing else to do
+    if (build_db) {
+        if (!BuildDatabase(build_db, options.threads)) {
+            cerr << "Cannot write " << build_db << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if((!batch && !serve && argc - arg < 2) || ((batch || serve) && argc - arg > 1)) {
+        cerr << "Usage: ./countdown [options] <target> <num1> <num2>...<numN>" << endl;
+        cerr << "       ./countdown [options] --batch [file]" << endl;
+        cerr << "       ./countdown [options] [--workers N] [--queue N] --serve [socket]" << endl;
+        cerr << "       ./countdown [--threads N] --build-db file" << endl;
+        cerr << "Options: [--memo | --mitm | --stream] [--first | --closest] [--distinct] [--hash-cons]" << endl;
+        cerr << "         [--count] [--max-intermediate N] [--format text|ndjson] [--threads N]" << endl;
+        cerr << "         [--operators " << OPERATOR_SYMBOLS << "] [--db file] [--cache MB] [--stats]" << endl;
         return 1;
     }
-    
-    uint32 target = atoi(argv[1]);
 
-    list<uint32> input_numbers;
-    for(int i=2; i<(argc); ++i) {
-        input_numbers.push_back( atoi(argv[i]) );
+    OutputWriter writer;
+    writer.set_format(format);
+    writer.set_count_only(options.count_only);
+    Solver solver(options);
+
+    // First and closest searches of standard draws are read from the
+    // database, the rest is solved
+    DatabaseQuery database_query;
+    const DatabaseQuery *query = NULL;
+    if (db) {
+        if (!database_query.database.open(db)) {
+            cerr << "Cannot open database " << db << endl;
+            return 1;
+        }
+        database_query.closest = options.mode == MODE_CLOSEST;
+        if (DatabaseGame(options) && DatabaseApplies(options.mode)) {
+            query = &database_query;
+        }
     }
 
-    GenExpressions(target, input_numbers, 0, 0);
+    // Requests from a socket, or from stdin until it ends
+    if (serve) {
+        signal(SIGPIPE, SIG_IGN);
+        // Requests choose their mode, the server checks it for each one
+        Server server(options, serve_workers, serve_queue,
+                      db && DatabaseGame(options) ? &database_query.database : NULL);
+        if (arg < argc) {
+            ServeSocket(argv[arg], server);
+            return 1;
+        }
+        server.read_requests(shared_ptr<Connection>(new Connection(0, 1, false)), true);
+        server.drain();
+        return 0;
+    }
+
+    // One puzzle per line, from a memory-mapped file or from stdin
+    if (batch) {
+        uint32 line = 0;
+        if (arg < argc) {
+            int fd = open(argv[arg], O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) < 0) {
+                cerr << "Cannot open " << argv[arg] << endl;
+                return 1;
+            }
+            if (st.st_size > 0) {
+                void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    cerr << "Cannot map " << argv[arg] << endl;
+                    return 1;
+                }
+                SolveBatch((const char *)data, (const char *)data + st.st_size, line, solver, query, writer);
+                munmap(data, st.st_size);
+            }
+            close(fd);
+        } else {
+            string text;
+            string input;
+            while (getline(cin, text)) {
+                input += text;
+                input += '\n';
+                // Solve in blocks, keeping memory flat on endless input
+                if (input.size() >= (1 << 16)) {
+                    SolveBatch(input.data(), input.data() + input.size(), line, solver, query, writer);
+                    input.clear();
+                }
+            }
+            SolveBatch(input.data(), input.data() + input.size(), line, solver, query, writer);
+        }
+        ReportNodes(solver, options);
+        return 0;
+    }
+
+    // Sources are tracked as bits of a 32-bit mask
+    if(argc - arg - 1 > 32) {
+        cerr << "At most 32 numbers are supported" << endl;
+        return 1;
+    }
+
+    // Each argument must be one number in range, as on a batch line
+    vector<uint32> input_numbers;
+    for(int i=arg; i<(argc); ++i) {
+        const char *p = argv[i];
+        const char *end = p + strlen(p);
+        uint32 n;
+        if (!ParseNumber(p, end, n) || p != end) {
+            cerr << "Not a number from 0 to " << ~0u << ": " << argv[i] << endl;
+            return 1;
+        }
+        input_numbers.push_back(n);
+    }
+    uint32 target = input_numbers[0];
+    input_numbers.erase(input_numbers.begin());
+
+    Solve(target, input_numbers, solver, query, writer);
+    ReportNodes(solver, options);
 
     return 0;
 }
-
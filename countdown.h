@@ -0,0 +1,316 @@
+#ifndef COUNTDOWN_H
+#define COUNTDOWN_H
+
+/* Countdown numbers solver as a library (libcountdown.a).
+ * A Solver owns all its scratch memory and keeps it warm between puzzles.
+ * There is no global state, so every thread can have its own Solver.
+ * Solutions are handed to a callback instead of being printed.
+ */
+
+#include <stddef.h>
+
+#include <coroutine>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+typedef unsigned int uint32;
+
+// What a solve reports
+enum SearchMode {
+    MODE_ALL,       // every expression equal to the target
+    MODE_FIRST,     // the first expression found equal to the target
+    MODE_CLOSEST    // one expression with the value nearest to the target
+};
+
+// How a puzzle is solved
+enum Algorithm {
+    ALGO_RECURSION, // GenExpressions
+    ALGO_MEMO,      // SubsetSolver tables of all subsets
+    ALGO_MITM,      // SubsetSolver, joining the two parts of the outer operator
+    ALGO_STREAM     // ExpressionCursor, no lists
+};
+
+// The tables of ALGO_MEMO, ALGO_MITM and the cache hold every subset of
+// the numbers. Puzzles with more numbers are solved by ALGO_RECURSION.
+const uint32 MAX_TABLE_NUMBERS = 16;
+
+class SolverCache;
+
+struct SolverOptions {
+    SolverOptions():
+        algorithm(ALGO_RECURSION),
+        mode(MODE_ALL),
+        distinct(false),
+        hash_cons(false),
+        count_only(false),
+        max_value(~0u),
+        threads(1),
+        operators("+-*/"),
+        cache_bytes(0),
+        cache(NULL),
+        stats(false)
+    {}
+
+    Algorithm algorithm;
+    SearchMode mode;
+    // Only one of the expressions that are equal up to associativity and
+    // commutativity
+    bool distinct;
+    // Share equal subtrees in the recursion, see share_node
+    bool hash_cons;
+    // Count solutions without calling the callback
+    bool count_only;
+    // Values above it are pruned, with the whole subtree
+    uint32 max_value;
+    // Workers of the recursion, the calling thread is one of them
+    uint32 threads;
+    // Symbols of the operators allowed, a subset of OPERATOR_SYMBOLS.
+    // Unknown symbols are ignored.
+    std::string operators;
+    // Memory for the tables of recent draws, 0 for none. With a cache
+    // every puzzle is solved from the ALGO_MEMO tables of its numbers in
+    // ascending order, so a draw seen before with another target costs
+    // no search. Solutions come in the order of those tables.
+    size_t cache_bytes;
+    // A cache shared with other solvers, used instead of cache_bytes. It
+    // must outlive the Solver.
+    SolverCache *cache;
+    // Collect SearchStats, at the cost of timing every combining loop
+    bool stats;
+};
+
+// Why the search skipped a pair of operands or a new expression
+enum PruneRule {
+    PRUNE_ORDER,        // left < right, for an operator that only takes left >= right
+    PRUNE_IDENTITY,     // the right operand is the identity of the operator
+    PRUNE_ABSORBING,    // an operand absorbs the other one
+    PRUNE_DOMAIN,       // outside the domain of the operator, or above max_value
+    PRUNE_CANONICAL,    // not the canonical form, with distinct
+    PRUNE_SHARED,       // merged into an equal expression, with hash_cons
+    PRUNE_RULES
+};
+
+// Counters of SolverOptions::stats, summed over all solves. The recursion
+// fills them all in, the other algorithms only nodes and the total time.
+// Times of several threads add up.
+struct SearchStats {
+    SearchStats(): nodes(0), matches(0), seconds(0), search_seconds(0),
+                   combine_seconds(0), render_seconds(0)
+    {
+        for(int r=0; r<PRUNE_RULES; ++r){
+            pruned[r] = 0;
+        }
+    }
+
+    unsigned long nodes;
+    // Expressions created at each depth of the recursion, 0 is the outer
+    // call. Searching for all solutions, the outer call only creates the
+    // single numbers and the matches; the pairs it combines without a
+    // match are in neither depth_nodes nor pruned. Sized to the deepest
+    // level of the largest puzzle, one less than its count of numbers.
+    std::vector<unsigned long> depth_nodes;
+    // Operators not applied to a pair, or expressions dropped, by rule
+    unsigned long pruned[PRUNE_RULES];
+    // Expressions equal to the target, before rendering
+    unsigned long matches;
+    // Wall time of the solves
+    double seconds;
+    // Time in the recursion, which is combining the expression lists,
+    // rendering the matches, and the rest: generating the lists
+    double search_seconds;
+    double combine_seconds;
+    double render_seconds;
+};
+
+// Every operator the solver knows: the four of the game, then ^ (power),
+// % (modulo) and | (digit concatenation: 25|3 is 253) for variant games
+extern const char *const OPERATOR_SYMBOLS;
+
+// Called for every solution with its expression, not NUL-terminated, and
+// its value: the target, or the closest value in MODE_CLOSEST. Calls of
+// one solve never overlap, even with several threads.
+typedef std::function<void(const char *expression_, size_t size_, uint32 value_)> SolutionCallback;
+
+class Solver {
+public:
+    explicit Solver(const SolverOptions &options_ = SolverOptions());
+    ~Solver();
+
+    // Reports the solutions of one puzzle to callback_, returns how many
+    // there were. At most 32 numbers, see MAX_TABLE_NUMBERS for the tables.
+    unsigned long solve(uint32 target_, const std::vector<uint32> &numbers_,
+                        const SolutionCallback &callback_);
+
+    // Reports one expression for every value in [min_target_, max_target_]
+    // that numbers_ can reach, built from as few numbers as possible.
+    // The tables of ALGO_MEMO are used whatever the algorithm is. Returns
+    // how many values were reached, 0 with more than MAX_TABLE_NUMBERS
+    // numbers.
+    unsigned long solve_targets(uint32 min_target_, uint32 max_target_,
+                                const std::vector<uint32> &numbers_,
+                                const SolutionCallback &callback_);
+
+    // Ends the solve running on another thread early, it reports what it
+    // found so far. Does nothing between solves. The recursion and
+    // ALGO_STREAM stop within a block of expressions, the memo tables
+    // within one split of a subset. Tables left incomplete are not cached.
+    void cancel();
+
+    // Expressions created over all solves
+    unsigned long nodes() const;
+    // Solves answered from the tables of SolverOptions::cache_bytes or
+    // cache, and solves that had to build them. A shared cache counts the
+    // solves of all its solvers.
+    unsigned long cache_hits() const;
+    unsigned long cache_misses() const;
+    // Empty unless SolverOptions::stats is set
+    SearchStats stats() const;
+
+private:
+    struct State;
+    State *state;
+
+    Solver(const Solver &);
+    Solver &operator=(const Solver &);
+};
+
+// The memo tables of recent draws, for several Solvers to share, e.g. the
+// workers of a server: max_bytes_ caps all of them together, and a draw
+// one of them solved is a hit for the others. Tables of solvers with other
+// operators or max_value are kept apart. Thread-safe.
+class SolverCache {
+public:
+    explicit SolverCache(size_t max_bytes_);
+    ~SolverCache();
+
+private:
+    friend class Solver;
+    struct State;
+    State *state;
+
+    SolverCache(const SolverCache &);
+    SolverCache &operator=(const SolverCache &);
+};
+
+
+/* Precomputed solutions of the standard game: every draw of 6 numbers from
+ * the pool 25 50 75 100 and two each of 1..10, with one expression for
+ * each target 100..999 the draw reaches, built from as few numbers as
+ * possible. The file is mapped as it is, so opening it costs nothing and
+ * a lookup reads one record.
+ */
+
+// Solves every draw with threads_ solvers and writes the database to
+// path_. Returns false if the file cannot be written.
+bool BuildDatabase(const char *path_, uint32 threads_ = 1);
+
+enum LookupResult {
+    LOOKUP_FOUND,
+    LOOKUP_UNREACHABLE, // the draw cannot reach the target
+    LOOKUP_MISSING      // not a standard draw or target, solve it instead
+};
+
+class SolutionDatabase {
+public:
+    SolutionDatabase();
+    ~SolutionDatabase();
+
+    // Maps the file, false if it is missing or not a database
+    bool open(const char *path_);
+
+    // The stored expression for target_ from numbers_, in any order
+    LookupResult lookup(uint32 target_, const std::vector<uint32> &numbers_,
+                        std::string &expression_) const;
+    // The stored expression with the value nearest to target_, in value_
+    LookupResult lookup_closest(uint32 target_, const std::vector<uint32> &numbers_,
+                                std::string &expression_, uint32 &value_) const;
+
+private:
+    const unsigned char *find_row(const std::vector<uint32> &numbers_,
+                                  unsigned char *draw_) const;
+
+    const unsigned char *data;
+    size_t size;
+
+    SolutionDatabase(const SolutionDatabase &);
+    SolutionDatabase &operator=(const SolutionDatabase &);
+};
+
+
+// Minimal coroutine generator: a range whose elements are computed when
+// the caller asks for them. Destroying it drops the suspended coroutine
+// with all the work it has not done yet.
+template<class T>
+class Generator {
+public:
+    struct promise_type {
+        const T *current;
+
+        Generator get_return_object(){
+            return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+        std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+        // value_ lives until the coroutine is resumed
+        std::suspend_always yield_value(const T &value_) noexcept {
+            current = &value_;
+            return std::suspend_always();
+        }
+        void return_void() {}
+        void unhandled_exception() { throw; }
+    };
+
+    class iterator {
+    public:
+        explicit iterator(std::coroutine_handle<promise_type> handle_): handle(handle_) {}
+        iterator &operator++(){
+            handle.resume();
+            return *this;
+        }
+        const T &operator*() const { return *handle.promise().current; }
+        bool operator!=(std::default_sentinel_t) const { return !handle.done(); }
+    private:
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    Generator(Generator &&other_): handle(other_.handle) { other_.handle = NULL; }
+    ~Generator(){
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    iterator begin(){
+        handle.resume();
+        return iterator(handle);
+    }
+    std::default_sentinel_t end(){ return std::default_sentinel; }
+
+private:
+    explicit Generator(std::coroutine_handle<promise_type> handle_): handle(handle_) {}
+
+    std::coroutine_handle<promise_type> handle;
+
+    Generator(const Generator &);
+    Generator &operator=(const Generator &);
+};
+
+// One expression equal to the target
+struct Solution {
+    std::string expression;
+    uint32 value;
+};
+
+// Every expression equal to target_, in the order of the recursion.
+// Nothing is searched past the solution the caller is at, so several
+// searches can be interleaved on one thread and left at any point.
+// Expressions enumerated are added to *nodes_ if it is given. operators_
+// are symbols like SolverOptions::operators.
+Generator<Solution>
+Solutions(uint32 target_, std::vector<uint32> sources_, bool distinct_ = false,
+          uint32 max_value_ = ~0u, unsigned long *nodes_ = NULL,
+          std::string operators_ = "+-*/");
+
+#endif
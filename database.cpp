@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "countdown.h"
+
+using namespace std;
+
+
+namespace {
+
+/* File layout, in host byte order:
+ *   DatabaseHeader
+ *   draws * DRAW_SIZE bytes     the draws, numbers ascending, the draws
+ *                               in ascending order
+ *   draws * targets records     record (d, t) is the expression of draw d
+ *                               for target min_target + t
+ * A record is RECORD_SIZE bytes of 4-bit tokens, the low half of a byte
+ * first: the expression in postfix, then TOKEN_END. Tokens below
+ * DRAW_SIZE are numbers by their position in the draw, the operators
+ * are TOKEN_OPERATOR + their position in DATABASE_OPERATORS. Six numbers
+ * and five operators leave room for the end token. An unreachable target
+ * starts with TOKEN_END.
+ */
+const char DATABASE_MAGIC[4] = { 'C', 'D', 'D', 'B' };
+const uint32 DATABASE_VERSION = 1;
+const uint32 DRAW_SIZE = 6;
+const uint32 RECORD_SIZE = 6;
+const uint32 MIN_TARGET = 100;
+const uint32 MAX_TARGET = 999;
+const char DATABASE_OPERATORS[] = "+-*/";
+const unsigned char TOKEN_OPERATOR = DRAW_SIZE;
+const unsigned char TOKEN_END = 0xF;
+
+struct DatabaseHeader {
+    char magic[4];
+    uint32 version;
+    uint32 draws;
+    uint32 draw_size;
+    uint32 min_target;
+    uint32 max_target;
+};
+
+// The standard pool: the large numbers once, the small ones twice
+const uint32 POOL_VALUES[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 25, 50, 75, 100 };
+const uint32 POOL_COUNTS[] = { 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  1,  1,  1,   1 };
+const uint32 POOL_SIZE = sizeof(POOL_VALUES) / sizeof(POOL_VALUES[0]);
+
+
+// Every draw of DRAW_SIZE numbers from the pool from value_i_ on, in
+// ascending order. draw_ holds the numbers chosen so far.
+void GenDraws(uint32 value_i_, vector<unsigned char> &draw_, vector<unsigned char> &draws_){
+    if (draw_.size() == DRAW_SIZE) {
+        draws_.insert(draws_.end(), draw_.begin(), draw_.end());
+        return;
+    }
+    for(uint32 i=value_i_; i<POOL_SIZE; ++i){
+        // Numbers of the draw are ascending, copies of a value are adjacent
+        uint32 used = count(draw_.begin(), draw_.end(), POOL_VALUES[i]);
+        if (used == POOL_COUNTS[i]) {
+            continue;
+        }
+        draw_.push_back(POOL_VALUES[i]);
+        GenDraws(i, draw_, draws_);
+        draw_.pop_back();
+    }
+}
+
+// Appends the tokens of the expression text at p_, returns the end of it
+const char *encode_expression(const char *p_, const unsigned char *draw_,
+                              vector<unsigned char> &tokens_){
+    if (*p_ == '(') {
+        p_ = encode_expression(p_ + 1, draw_, tokens_);
+        unsigned char op = strchr(DATABASE_OPERATORS, *p_) - DATABASE_OPERATORS;
+        p_ = encode_expression(p_ + 1, draw_, tokens_);
+        tokens_.push_back(TOKEN_OPERATOR + op);
+        return p_ + 1;
+    }
+    uint32 value = 0;
+    for(; *p_ >= '0' && *p_ <= '9'; ++p_){
+        value = value * 10 + (*p_ - '0');
+    }
+    // Equal numbers render the same, the first one stands for all
+    tokens_.push_back(find(draw_, draw_ + DRAW_SIZE, value) - draw_);
+    return p_;
+}
+
+void pack_record(const vector<unsigned char> &tokens_, unsigned char *record_){
+    memset(record_, 0, RECORD_SIZE);
+    for(uint32 i=0; i<RECORD_SIZE * 2; ++i){
+        unsigned char token = i < tokens_.size() ? tokens_[i] : TOKEN_END;
+        record_[i / 2] |= token << (i % 2 * 4);
+    }
+}
+
+// Solves the draws taken from next_ and fills their records
+void SolveDraws(const vector<unsigned char> &draws_, atomic<uint32> &next_,
+                vector<unsigned char> &records_){
+    SolverOptions options;
+    options.algorithm = ALGO_MEMO;
+    Solver solver(options);
+    uint32 targets = MAX_TARGET - MIN_TARGET + 1;
+    uint32 draw_count = draws_.size() / DRAW_SIZE;
+    vector<uint32> numbers(DRAW_SIZE);
+    vector<unsigned char> tokens;
+    string text;
+
+    for(uint32 d = next_++; d < draw_count; d = next_++){
+        const unsigned char *draw = &draws_[d * DRAW_SIZE];
+        numbers.assign(draw, draw + DRAW_SIZE);
+        unsigned char *row = &records_[size_t(d) * targets * RECORD_SIZE];
+        solver.solve_targets(MIN_TARGET, MAX_TARGET, numbers,
+            [&](const char *expression_, size_t size_, uint32 value_){
+                text.assign(expression_, size_);
+                tokens.clear();
+                encode_expression(text.c_str(), draw, tokens);
+                pack_record(tokens, row + (value_ - MIN_TARGET) * RECORD_SIZE);
+            });
+    }
+}
+
+} // namespace
+
+bool BuildDatabase(const char *path_, uint32 threads_){
+    vector<unsigned char> draw, draws;
+    GenDraws(0, draw, draws);
+    uint32 draw_count = draws.size() / DRAW_SIZE;
+    uint32 targets = MAX_TARGET - MIN_TARGET + 1;
+
+    // Every record starts out unreachable
+    vector<unsigned char> records(size_t(draw_count) * targets * RECORD_SIZE, TOKEN_END | TOKEN_END << 4);
+    atomic<uint32> next(0);
+    vector<thread> helpers;
+    for(uint32 t=1; t<threads_; ++t){
+        helpers.push_back(thread(SolveDraws, cref(draws), ref(next), ref(records)));
+    }
+    SolveDraws(draws, next, records);
+    for(size_t t=0; t<helpers.size(); ++t){
+        helpers[t].join();
+    }
+
+    DatabaseHeader header;
+    memcpy(header.magic, DATABASE_MAGIC, sizeof(header.magic));
+    header.version = DATABASE_VERSION;
+    header.draws = draw_count;
+    header.draw_size = DRAW_SIZE;
+    header.min_target = MIN_TARGET;
+    header.max_target = MAX_TARGET;
+
+    FILE *file = fopen(path_, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(&draws[0], 1, draws.size(), file) == draws.size() &&
+              fwrite(&records[0], 1, records.size(), file) == records.size();
+    return fclose(file) == 0 && ok;
+}
+
+
+SolutionDatabase::SolutionDatabase(): data(NULL), size(0) {}
+
+SolutionDatabase::~SolutionDatabase(){
+    if (data) {
+        munmap((void *)data, size);
+    }
+}
+
+bool SolutionDatabase::open(const char *path_){
+    int fd = ::open(path_, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(DatabaseHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const DatabaseHeader *header = (const DatabaseHeader *)map;
+    size_t targets = header->max_target - header->min_target + 1;
+    if (memcmp(header->magic, DATABASE_MAGIC, sizeof(header->magic)) ||
+        header->version != DATABASE_VERSION || header->draw_size != DRAW_SIZE ||
+        header->min_target > header->max_target ||
+        size_t(st.st_size) != sizeof(DatabaseHeader) +
+                              header->draws * (DRAW_SIZE + targets * RECORD_SIZE)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    if (data) {
+        munmap((void *)data, size);
+    }
+    data = (const unsigned char *)map;
+    size = st.st_size;
+    return true;
+}
+
+// Row of records of the draw of numbers_, NULL if it is not stored
+const unsigned char *SolutionDatabase::find_row(const vector<uint32> &numbers_,
+                                                unsigned char *draw_) const {
+    const DatabaseHeader *header = (const DatabaseHeader *)data;
+    if (!data || numbers_.size() != DRAW_SIZE) {
+        return NULL;
+    }
+    for(uint32 i=0; i<DRAW_SIZE; ++i){
+        if (numbers_[i] > 0xFF) {
+            return NULL;
+        }
+        draw_[i] = numbers_[i];
+    }
+    sort(draw_, draw_ + DRAW_SIZE);
+
+    // Binary search of the sorted draws
+    const unsigned char *draws = data + sizeof(DatabaseHeader);
+    uint32 lo = 0, hi = header->draws;
+    while (lo < hi) {
+        uint32 mid = lo + (hi - lo) / 2;
+        if (memcmp(draws + mid * DRAW_SIZE, draw_, DRAW_SIZE) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == header->draws || memcmp(draws + lo * DRAW_SIZE, draw_, DRAW_SIZE)) {
+        return NULL;
+    }
+    size_t targets = header->max_target - header->min_target + 1;
+    return draws + header->draws * DRAW_SIZE + lo * targets * RECORD_SIZE;
+}
+
+namespace {
+
+// Renders record_ with the numbers of draw_. An empty record is
+// LOOKUP_UNREACHABLE, a corrupt one LOOKUP_MISSING, so it is solved.
+LookupResult decode_record(const unsigned char *record_, const unsigned char *draw_,
+                           string &expression_){
+    const uint32 operators = sizeof(DATABASE_OPERATORS) - 1;
+    // Operands of the operators still to come
+    string stack[DRAW_SIZE];
+    uint32 depth = 0;
+    for(uint32 i=0; i<RECORD_SIZE * 2; ++i){
+        unsigned char token = record_[i / 2] >> (i % 2 * 4) & 0xF;
+        if (token == TOKEN_END) {
+            break;
+        }
+        if (token < TOKEN_OPERATOR) {
+            if (depth == DRAW_SIZE) {
+                return LOOKUP_MISSING;
+            }
+            stack[depth++] = to_string(draw_[token]);
+            continue;
+        }
+        if (token >= TOKEN_OPERATOR + operators || depth < 2) {
+            return LOOKUP_MISSING;
+        }
+        string &lhs = stack[depth - 2];
+        lhs = "(" + lhs + DATABASE_OPERATORS[token - TOKEN_OPERATOR] + stack[depth - 1] + ")";
+        --depth;
+    }
+    if (!depth) {
+        return LOOKUP_UNREACHABLE;
+    }
+    if (depth > 1) {
+        return LOOKUP_MISSING;
+    }
+    expression_ = stack[0];
+    return LOOKUP_FOUND;
+}
+
+} // namespace
+
+LookupResult SolutionDatabase::lookup(uint32 target_, const vector<uint32> &numbers_,
+                                      string &expression_) const {
+    unsigned char draw[DRAW_SIZE];
+    const unsigned char *row = find_row(numbers_, draw);
+    const DatabaseHeader *header = (const DatabaseHeader *)data;
+    if (!row || target_ < header->min_target || target_ > header->max_target) {
+        return LOOKUP_MISSING;
+    }
+    return decode_record(row + (target_ - header->min_target) * RECORD_SIZE, draw, expression_);
+}
+
+LookupResult SolutionDatabase::lookup_closest(uint32 target_, const vector<uint32> &numbers_,
+                                              string &expression_, uint32 &value_) const {
+    unsigned char draw[DRAW_SIZE];
+    const unsigned char *row = find_row(numbers_, draw);
+    const DatabaseHeader *header = (const DatabaseHeader *)data;
+    if (!row || target_ < header->min_target || target_ > header->max_target) {
+        return LOOKUP_MISSING;
+    }
+    // Outwards from the target, below first. Past the ends of the stored
+    // range a closer value may exist that is not stored.
+    for(uint32 distance=0; ; ++distance){
+        if (target_ - header->min_target < distance || header->max_target - target_ < distance) {
+            return LOOKUP_MISSING;
+        }
+        uint32 candidates[2] = { target_ - distance, target_ + distance };
+        for(int i=0; i<2; ++i){
+            const unsigned char *record = row + (candidates[i] - header->min_target) * RECORD_SIZE;
+            LookupResult res = decode_record(record, draw, expression_);
+            if (res == LOOKUP_FOUND) {
+                value_ = candidates[i];
+            }
+            if (res != LOOKUP_UNREACHABLE) {
+                return res;
+            }
+        }
+    }
+}
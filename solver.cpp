@@ -0,0 +1,2631 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "countdown.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(COUNTDOWN_NO_SIMD)
+#define COUNTDOWN_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Everything up to the Solver and SolverCache members is internal to the
+// library
+namespace {
+
+
+// Growing char buffer that solutions are rendered into. The memory is
+// kept when the buffer is cleared, so rendering does not allocate once warm.
+class OutputBuffer {
+public:
+    void append(char c_){
+        bytes.push_back(c_);
+    }
+    void append(const char *text_, size_t size_){
+        bytes.insert(bytes.end(), text_, text_ + size_);
+    }
+    // Converter int -> text, without a temporary string
+    void append_uint(uint32 i){
+        char digits[10];
+        int n = 0;
+        do {
+            digits[n++] = '0' + i % 10;
+            i /= 10;
+        } while (i);
+        while (n) {
+            bytes.push_back(digits[--n]);
+        }
+    }
+
+    const char *data() const {return bytes.empty() ? NULL : &bytes[0];}
+    size_t size() const {return bytes.size();}
+    void truncate(size_t size_){ bytes.resize(size_); }
+    void clear(){ bytes.clear(); }
+
+private:
+    vector<char> bytes;
+};
+
+// Solution lines waiting for the sink: the expressions back to back, with
+// where each one is and its value, so the sink does not parse them again
+class SolutionLines : public OutputBuffer {
+public:
+    struct Line {
+        size_t offset;
+        size_t size;
+        uint32 value;
+    };
+
+    // Ends the expression appended since the last line
+    void end_line(uint32 value_){
+        size_t offset = lines.empty() ? 0 : lines.back().offset + lines.back().size;
+        Line line = { offset, size() - offset, value_ };
+        lines.push_back(line);
+    }
+
+    const vector<Line> &get_lines() const {return lines;}
+    void clear(){
+        OutputBuffer::clear();
+        lines.clear();
+    }
+
+private:
+    vector<Line> lines;
+};
+
+// Number of set bits, i.e. sources in a bitmask
+inline uint32 count_bits(uint32 mask){
+    return __builtin_popcount(mask);
+}
+
+// Signature of one source number. The signature of an expression is the
+// sum over the numbers it uses.
+inline uint32 number_signature(uint32 value_){
+    uint32 h = value_ * 0x9E3779B1u;
+    h ^= h >> 15;
+    h *= 0x85EBCA77u;
+    return h ^ (h >> 13);
+}
+
+/* Operator registry. Each operator is a type that declares its algebraic
+ * properties, and the generic pruning in OperatorSet::valid is derived
+ * from them:
+ *   commutative  - a op b == b op a, only a >= b is generated
+ *   left_ge_right - the domain has no a < b, pairs like that are skipped
+ *                   without trying the operator
+ *   identity     - e with a op e == a, such results are not generated
+ *   absorbing    - z with z op a == z (and a op z == z if commutative)
+ *   domain()     - the partial operator check, max_value_ is the largest
+ *                  result allowed
+ *   family, inverse - the chains of the canonical forms, see canonical_lhs
+ * apply() is only called on operands valid() accepts. right_operand()
+ * is the right operand that gives result_, if exactly one can; otherwise
+ * unique_right is false and the operands are searched.
+ * index is the position in AllOperators, the op_index of expressions.
+ */
+const long long NO_ELEMENT = -1;
+
+// No rule prunes the pair
+const PruneRule PRUNE_NONE = PRUNE_RULES;
+
+enum OperatorFamily {
+    FAMILY_NONE = -1,
+    FAMILY_SUM,         // + -
+    FAMILY_PRODUCT,     // * /
+    FAMILY_CONCAT       // |
+};
+
+// Integer power, false if it is above max_value_
+inline bool power(uint32 base_, uint32 exponent_, uint32 max_value_, uint32 &res_){
+    unsigned long long res = 1;
+    for(uint32 i=0; i<exponent_; ++i){
+        res *= base_;
+        if (res > max_value_) {
+            return false;
+        }
+    }
+    res_ = res;
+    return true;
+}
+
+// The power of 10 above value_: the shift of a concatenated right operand
+inline unsigned long long decimal_shift(uint32 value_){
+    unsigned long long res = 10;
+    while (res <= value_) {
+        res *= 10;
+    }
+    return res;
+}
+
+struct OpAdd {
+    static const int index = 0;
+    static const char symbol = '+';
+    static const bool commutative = true;
+    static const bool left_ge_right = false;
+    static constexpr long long identity = 0;
+    static constexpr long long absorbing = NO_ELEMENT;
+    static const OperatorFamily family = FAMILY_SUM;
+    static const bool inverse = false;
+    static const bool unique_right = true;
+
+    static uint32 apply(uint32 left, uint32 right){
+        return left + right;
+    }
+    // Avoid results that wrap around or exceed the cap
+    static bool domain(uint32 left, uint32 right, uint32 max_value_){
+        return (unsigned long long)left + right <= max_value_;
+    }
+    static bool right_operand(uint32 left, uint32 result_, uint32 &right_){
+        right_ = result_ - left;
+        return result_ >= left;
+    }
+};
+
+struct OpSub {
+    static const int index = 1;
+    static const char symbol = '-';
+    static const bool commutative = false;
+    static const bool left_ge_right = true;
+    static constexpr long long identity = 0;
+    static constexpr long long absorbing = NO_ELEMENT;
+    static const OperatorFamily family = FAMILY_SUM;
+    static const bool inverse = true;
+    static const bool unique_right = true;
+
+    static uint32 apply(uint32 left, uint32 right){
+        return left - right;
+    }
+    // Avoid a-b=0 and negative numbers. a-b is never above a.
+    static bool domain(uint32 left, uint32 right, uint32){
+        return left > right;
+    }
+    static bool right_operand(uint32 left, uint32 result_, uint32 &right_){
+        right_ = left - result_;
+        return left >= result_;
+    }
+};
+
+struct OpMult {
+    static const int index = 2;
+    static const char symbol = '*';
+    static const bool commutative = true;
+    static const bool left_ge_right = false;
+    static constexpr long long identity = 1;
+    static constexpr long long absorbing = 0;
+    static const OperatorFamily family = FAMILY_PRODUCT;
+    static const bool inverse = false;
+    static const bool unique_right = true;
+
+    static uint32 apply(uint32 left, uint32 right){
+        return left * right;
+    }
+    static bool domain(uint32 left, uint32 right, uint32 max_value_){
+        return (unsigned long long)left * right <= max_value_;
+    }
+    static bool right_operand(uint32 left, uint32 result_, uint32 &right_){
+        if (!left) {
+            right_ = 0;
+            return !result_;
+        }
+        right_ = result_ / left;
+        return result_ % left == 0;
+    }
+};
+
+struct OpDivide {
+    static const int index = 3;
+    static const char symbol = '/';
+    static const bool commutative = false;
+    static const bool left_ge_right = true;
+    static constexpr long long identity = 1;
+    static constexpr long long absorbing = 0;
+    static const OperatorFamily family = FAMILY_PRODUCT;
+    static const bool inverse = true;
+    static const bool unique_right = true;
+
+    static uint32 apply(uint32 left, uint32 right){
+        return left / right;
+    }
+    // Avoid x/0 and 1/3, only 3/1
+    static bool domain(uint32 left, uint32 right, uint32){
+        return right && left % right == 0;
+    }
+    static bool right_operand(uint32 left, uint32 result_, uint32 &right_){
+        if (!result_) {
+            return false;
+        }
+        right_ = left / result_;
+        return left % result_ == 0;
+    }
+};
+
+// Variant games
+
+struct OpPow {
+    static const int index = 4;
+    static const char symbol = '^';
+    static const bool commutative = false;
+    static const bool left_ge_right = false;
+    static constexpr long long identity = 1;
+    static constexpr long long absorbing = 1;
+    static const OperatorFamily family = FAMILY_NONE;
+    static const bool inverse = false;
+    static const bool unique_right = true;
+
+    static uint32 apply(uint32 left, uint32 right){
+        uint32 res = 0;
+        power(left, right, ~0u, res);
+        return res;
+    }
+    // 0^b and a^0 are constants that cost a number
+    static bool domain(uint32 left, uint32 right, uint32 max_value_){
+        uint32 res;
+        return left && right && power(left, right, max_value_, res);
+    }
+    static bool right_operand(uint32 left, uint32 result_, uint32 &right_){
+        if (left < 2) {
+            return false;
+        }
+        unsigned long long value = left;
+        for(right_=1; value < result_; ++right_){
+            value *= left;
+        }
+        return value == result_;
+    }
+};
+
+struct OpMod {
+    static const int index = 5;
+    static const char symbol = '%';
+    static const bool commutative = false;
+    static const bool left_ge_right = true;
+    static constexpr long long identity = NO_ELEMENT;
+    static constexpr long long absorbing = 0;
+    static const OperatorFamily family = FAMILY_NONE;
+    static const bool inverse = false;
+    static const bool unique_right = false;
+
+    static uint32 apply(uint32 left, uint32 right){
+        return left % right;
+    }
+    // a%b is a for a < b, and 0 like a-a when b divides a
+    static bool domain(uint32 left, uint32 right, uint32){
+        return right && left > right && left % right;
+    }
+    static bool right_operand(uint32, uint32, uint32 &){
+        return false;
+    }
+};
+
+// Digit concatenation: 25|3 is 253
+struct OpConcat {
+    static const int index = 6;
+    static const char symbol = '|';
+    static const bool commutative = false;
+    static const bool left_ge_right = false;
+    static constexpr long long identity = NO_ELEMENT;
+    static constexpr long long absorbing = NO_ELEMENT;
+    static const OperatorFamily family = FAMILY_CONCAT;
+    static const bool inverse = false;
+    static const bool unique_right = true;
+
+    static uint32 apply(uint32 left, uint32 right){
+        return left * decimal_shift(right) + right;
+    }
+    // No leading zeros: 0|5 would be 5
+    static bool domain(uint32 left, uint32 right, uint32 max_value_){
+        return left && left * decimal_shift(right) + right <= max_value_;
+    }
+    static bool right_operand(uint32 left, uint32 result_, uint32 &right_){
+        for(unsigned long long shift=10; shift <= (unsigned long long)result_ * 10; shift *= 10){
+            right_ = result_ % shift;
+            if (result_ / shift == left && decimal_shift(right_) == shift) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// A set of operators. Every set is a separate instantiation of the code
+// using it. The combining kernels are instantiated for each subset of
+// StandardOperators, games with other operators share the one for
+// AllOperators and skip what is not in their mask (see GameOperators).
+// The op_index passed around is the registry index of the operator.
+template<class... Ops>
+struct OperatorSet {
+    static const int size = sizeof...(Ops);
+    // Bits of the registry indices in the set
+    static const uint32 mask = ((1u << Ops::index) | ...);
+    // Operators that never take a left operand smaller than the right one
+    static const uint32 ordered = (((Ops::commutative || Ops::left_ge_right) ? 1u << Ops::index : 0) | ...);
+    static const uint32 commutative = ((Ops::commutative ? 1u << Ops::index : 0) | ...);
+    static const uint32 inverse = ((Ops::inverse ? 1u << Ops::index : 0) | ...);
+    static const uint32 unique_right = ((Ops::unique_right ? 1u << Ops::index : 0) | ...);
+    // By position, which is the op_index in AllOperators
+    static constexpr char symbols[size + 1] = { Ops::symbol..., '\0' };
+    static constexpr OperatorFamily families[size] = { Ops::family... };
+
+    static constexpr bool indexed(){
+        int i = 0;
+        return ((Ops::index == i++) && ...);
+    }
+
+    // Calls f_(op_index, Op()) for every operator, op_index is an
+    // integral_constant
+    template<class F>
+    static void for_each(F &&f_){
+        (f_(integral_constant<int, Ops::index>(), Ops()), ...);
+    }
+
+    // The first of the pruning rules derived from the properties of Op
+    // that skips the pair, PRUNE_NONE if Op can be applied
+    template<class Op>
+    static PruneRule prune_rule(uint32 left_, uint32 right_, uint32 max_value_){
+        // Optimization - avoid duplications like a+b,b+a or a*b,b*a.
+        if ((Op::commutative || Op::left_ge_right) && left_ < right_) {
+            return PRUNE_ORDER;
+        }
+        if (right_ == Op::identity) {
+            return PRUNE_IDENTITY;
+        }
+        if (left_ == Op::absorbing || (Op::commutative && right_ == Op::absorbing)) {
+            return PRUNE_ABSORBING;
+        }
+        return Op::domain(left_, right_, max_value_) ? PRUNE_NONE : PRUNE_DOMAIN;
+    }
+
+    template<class Op>
+    static bool valid(uint32 left_, uint32 right_, uint32 max_value_){
+        return prune_rule<Op>(left_, right_, max_value_) == PRUNE_NONE;
+    }
+
+    // The rule for operator op_index_, for the statistics
+    static PruneRule prune_rule(int op_index_, uint32 left_, uint32 right_, uint32 max_value_){
+        PruneRule res = PRUNE_NONE;
+        for_each([&](auto op_index, auto op){
+            if (op_index == op_index_) {
+                res = prune_rule<decltype(op)>(left_, right_, max_value_);
+            }
+        });
+        return res;
+    }
+
+    // Result of operator op_index_ in value_, false if it is pruned
+    static bool combine(int op_index_, uint32 left_, uint32 right_, uint32 max_value_,
+                        uint32 &value_){
+        bool res = false;
+        for_each([&](auto op_index, auto op){
+            if (op_index == op_index_ && valid<decltype(op)>(left_, right_, max_value_)) {
+                value_ = op.apply(left_, right_);
+                res = true;
+            }
+        });
+        return res;
+    }
+
+    // The right operand that gives result_ with op_index_ and left_, if
+    // there is one. It still has to pass combine.
+    static bool right_operand(int op_index_, uint32 left_, uint32 result_, uint32 &right_){
+        bool res = false;
+        for_each([&](auto op_index, auto op){
+            if (op_index == op_index_) {
+                res = op.right_operand(left_, result_, right_);
+            }
+        });
+        return res;
+    }
+};
+
+// Every operator the solver knows, in index order
+typedef OperatorSet<OpAdd, OpSub, OpMult, OpDivide, OpPow, OpMod, OpConcat> AllOperators;
+const int MAX_OPERATORS = AllOperators::size;
+static_assert(AllOperators::indexed(), "AllOperators must list the operators in index order");
+
+// The operators of the game. The AVX2 kernel is written for this set.
+typedef OperatorSet<OpAdd, OpSub, OpMult, OpDivide> StandardOperators;
+
+// The operators of one game, by their symbols, with the combining kernel
+// instantiated for them
+struct CombineBlock;
+typedef void (*combine_values_t)(uint32, const uint32 *, uint32, uint32, uint32, uint32,
+                                 CombineBlock &);
+struct GameOperators {
+    explicit GameOperators(const string &symbols_ = "+-*/");
+
+    // Operator op_index_ of the game, see OperatorSet::combine. op_index_
+    // must be in mask.
+    bool combine(int op_index_, uint32 left_, uint32 right_, uint32 max_value_,
+                 uint32 &value_) const {
+        if (!(mask & ~StandardOperators::mask)) {
+            return StandardOperators::combine(op_index_, left_, right_, max_value_, value_);
+        }
+        return AllOperators::combine(op_index_, left_, right_, max_value_, value_);
+    }
+
+    string symbols() const {
+        string res;
+        for(int op=0; op < AllOperators::size; ++op){
+            if (mask >> op & 1) {
+                res += AllOperators::symbols[op];
+            }
+        }
+        return res;
+    }
+
+    uint32 mask;
+    // All of them skip pairs with left < right
+    bool ordered;
+    combine_values_t combine_values;
+};
+
+
+// Bump allocator for expression nodes. Memory is handed out from big
+// chunks and released all at once by reset(); the chunks are kept, so
+// the next solve reuses them without touching the heap.
+class Arena {
+public:
+    Arena(): current(0), offset(0) {}
+    ~Arena(){
+        for(size_t i=0; i<chunks.size(); ++i){
+            free(chunks[i].memory);
+        }
+    }
+
+    void *allocate(size_t size_){
+        size_ = (size_ + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        while (current == chunks.size() || offset + size_ > chunks[current].size) {
+            if (current < chunks.size()) {
+                ++current;
+                offset = 0;
+                continue;
+            }
+            size_t size = size_ > CHUNK_SIZE ? size_ : CHUNK_SIZE;
+            Chunk c = { (char *)malloc(size), size };
+            chunks.push_back(c);
+            offset = 0;
+        }
+        void *res = chunks[current].memory + offset;
+        offset += size_;
+        return res;
+    }
+
+    // Release everything allocated since the last reset
+    void reset(){
+        current = 0;
+        offset = 0;
+    }
+
+    // Position to release back to, keeping what was allocated before it
+    struct Mark {
+        size_t chunk;
+        size_t offset;
+    };
+
+    Mark mark() const {
+        Mark m = { current, offset };
+        return m;
+    }
+
+    void rewind(const Mark &mark_){
+        current = mark_.chunk;
+        offset = mark_.offset;
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    struct Chunk {
+        char *memory;
+        size_t size;
+    };
+
+    vector<Chunk> chunks;
+    size_t current;
+    size_t offset;
+
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+};
+
+} // namespace
+
+// Allocation functions cannot be in a namespace
+inline void *operator new(size_t size_, Arena &arena_){
+    return arena_.allocate(size_);
+}
+inline void operator delete(void *, Arena &){}
+
+namespace {
+
+
+// Expression - has left and right branches and an operator between them.
+// Nodes live in an Arena and are never deleted one by one. Remaining
+// sources are a bitmask of indexes into the input numbers, the signature
+// identifies the numbers used (see canonical forms).
+// With hash-consing a node may have alternatives: other nodes that can
+// replace it in any expression (see share_node).
+class Expression {
+public:
+    // value_ is the result of the operator, computed by the caller
+    Expression(int op_index_, Expression &lhs_, Expression &rhs_, uint32 value_):
+        op_index(op_index_),
+        lhs(lhs_),
+        rhs(rhs_),
+        next_alternative(NULL),
+        remaining_mask(rhs_.remaining_mask),
+        signature(lhs_.signature + rhs_.signature),
+        value(value_)
+    {}
+    Expression(uint32 value_, uint32 remaining_mask_):
+        op_index(-1),
+        lhs(*this),
+        rhs(*this),
+        next_alternative(NULL),
+        remaining_mask(remaining_mask_),
+        signature(number_signature(value_)),
+        value(value_)
+    {}
+
+    uint32 get_value() const {return value;}
+    uint32 get_rem_sources() const {return remaining_mask;}
+    uint32 get_signature() const {return signature;}
+    int get_op() const {return op_index;}
+    const Expression &get_lhs() const {return lhs;}
+    const Expression &get_rhs() const {return rhs;}
+    const Expression *get_next_alternative() const {return next_alternative;}
+    // Adds alternative_ with the alternatives chained to it
+    void add_alternative(Expression *alternative_){
+        Expression *last = alternative_;
+        while (last->next_alternative) {
+            last = last->next_alternative;
+        }
+        last->next_alternative = next_alternative;
+        next_alternative = alternative_;
+    }
+    void render(OutputBuffer &out_) const {
+        if (&lhs == this) { out_.append_uint( value ); }
+        else {
+            out_.append('(');
+            lhs.render(out_);
+            out_.append(AllOperators::symbols[op_index]);
+            rhs.render(out_);
+            out_.append(')');
+        }
+    }
+
+private:
+    int op_index;
+    Expression &lhs;
+    Expression &rhs;
+    Expression *next_alternative;
+    uint32 remaining_mask;
+    uint32 signature;
+    uint32 value;
+
+};
+
+// Expressions of one recursion level, stored in the arena as parallel
+// arrays. The combine loop scans values without touching the nodes, which
+// are only needed to build on them.
+struct ExprList {
+    Expression **items;
+    uint32 *values;
+    uint32 size;
+};
+
+// Nodes of one recursion level indexed by what the search looks at when
+// a node is an operand: its value and the sources left for the rest.
+// With distinct output the operator and the last chain term (see canonical
+// forms) are part of the key as well.
+// Open addressing over a power-of-two slot array; clear() only resets the
+// slots that were used, so small levels stay cheap to reuse.
+class SharedNodes {
+public:
+    SharedNodes(): slots(16, (Expression *)NULL) {}
+
+    void clear(){
+        for(size_t i=0; i<used.size(); ++i){
+            slots[used[i]] = NULL;
+        }
+        used.clear();
+    }
+
+    // Returns the node with the same key as e_, or adds e_ and returns NULL
+    Expression *insert(Expression *e_, bool distinct_){
+        if (2 * (used.size() + 1) > slots.size()) {
+            grow(distinct_);
+        }
+        uint32 mask = slots.size() - 1;
+        for(uint32 i=hash(*e_, distinct_) & mask; ; i=(i+1) & mask){
+            if (!slots[i]) {
+                slots[i] = e_;
+                used.push_back(i);
+                return NULL;
+            }
+            if (same_key(*slots[i], *e_, distinct_)) {
+                return slots[i];
+            }
+        }
+    }
+
+private:
+    static uint32 hash(const Expression &e_, bool distinct_){
+        uint32 h = e_.get_rem_sources() * 0x9E3779B1u + e_.get_value();
+        if (distinct_) {
+            h = h * 0x9E3779B1u + e_.get_op();
+            h = h * 0x9E3779B1u + e_.get_rhs().get_value();
+            h = h * 0x9E3779B1u + e_.get_rhs().get_signature();
+        }
+        h ^= h >> 15;
+        h *= 0x85EBCA77u;
+        return h ^ (h >> 13);
+    }
+
+    static bool same_key(const Expression &a_, const Expression &b_, bool distinct_){
+        if (a_.get_rem_sources() != b_.get_rem_sources() || a_.get_value() != b_.get_value()) {
+            return false;
+        }
+        return !distinct_ || (a_.get_op() == b_.get_op() &&
+                              a_.get_rhs().get_value() == b_.get_rhs().get_value() &&
+                              a_.get_rhs().get_signature() == b_.get_rhs().get_signature());
+    }
+
+    void grow(bool distinct_){
+        vector<Expression *> old;
+        old.swap(slots);
+        slots.assign(old.size() * 2, (Expression *)NULL);
+        used.clear();
+        for(size_t i=0; i<old.size(); ++i){
+            if (old[i]) {
+                insert(old[i], distinct_);
+            }
+        }
+    }
+
+    vector<Expression *> slots;
+    vector<uint32> used;
+};
+
+// Receives the rendered solution lines and hands them to the callback of
+// the solve. Several workers may share one sink, every block of whole
+// lines is passed on under the lock.
+class SolutionSink {
+public:
+    SolutionSink(): count_only(false), count(0) {}
+
+    // Only count the lines
+    void set_count_only(bool count_only_){
+        count_only = count_only_;
+    }
+
+    // Called before every solve
+    void start_solve(const SolutionCallback *callback_){
+        callback = callback_;
+        count = 0;
+    }
+
+    // Lines reported in the current solve
+    unsigned long solutions() const {return count;}
+
+    void write(SolutionLines &out_){
+        if (out_.get_lines().empty()) {
+            return;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            const vector<SolutionLines::Line> &lines = out_.get_lines();
+            for(size_t i=0; i<lines.size(); ++i){
+                ++count;
+                if (!count_only) {
+                    (*callback)(out_.data() + lines[i].offset, lines[i].size, lines[i].value);
+                }
+            }
+        }
+        out_.clear();
+    }
+
+private:
+    mutex lock;
+    bool count_only;
+    const SolutionCallback *callback;
+    unsigned long count;
+};
+
+// Settings shared by all workers of a solve. stop is raised to cancel the
+// remaining work, e.g. once the closest value hits the target or the first
+// match is found.
+// With distinct only canonical forms are generated. With hash_cons only
+// one node per SharedNodes key of a level is combined further.
+// No expression, not even a single number, has a value above max_value.
+struct SearchControl {
+    SearchControl(): mode(MODE_ALL), distinct(false), hash_cons(false), max_value(~0u), stop(false) {}
+
+    SearchMode mode;
+    bool distinct;
+    bool hash_cons;
+    uint32 max_value;
+    GameOperators operators;
+    atomic<bool> stop;
+};
+
+// Memory reused by every solve: nodes go to the arena, and each recursion
+// depth collects its expressions in a scratch vector before copying them
+// into the arena. Calls on the same depth never overlap.
+// Matches are kept as node pointers and only rendered by FlushMatches.
+// With hash-consing every level also indexes its nodes in SharedNodes, and
+// line and pending hold the state of RenderAlternatives.
+// The closest expression so far is rendered right away, as its node may be
+// released before the solve ends.
+// Every thread has its own buffers.
+struct SolveBuffers {
+    SolveBuffers(): sink(NULL), control(NULL), nodes(0), stats(NULL), best_distance(~0u), best_value(0) {}
+
+    Arena arena;
+    vector< vector<Expression *> > levels;
+    vector<SharedNodes> shared;
+    vector<Expression *> matches;
+    SolutionLines out;
+    SolutionSink *sink;
+    SearchControl *control;
+    unsigned long nodes;
+    // NULL unless SolverOptions::stats is set
+    SearchStats *stats;
+
+    uint32 best_distance;
+    uint32 best_value;
+    OutputBuffer best_text;
+
+    // An expression still to be rendered, or a single char when e is NULL
+    struct RenderItem {
+        const Expression *e;
+        char c;
+    };
+    OutputBuffer line;
+    vector<RenderItem> pending;
+};
+
+
+// Adds the seconds of its lifetime to *seconds_, if it is given
+class StatsTimer {
+public:
+    explicit StatsTimer(double *seconds_): seconds(seconds_) {
+        if (seconds) {
+            start = chrono::steady_clock::now();
+        }
+    }
+    ~StatsTimer(){
+        if (seconds) {
+            *seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+    }
+
+private:
+    double *seconds;
+    chrono::steady_clock::time_point start;
+};
+
+
+// Keeps e if it is nearer to target than everything seen before,
+// and cancels the search on an exact hit. E is an Expression or an
+// ExpressionCursor.
+template<class E>
+inline void compare_closest(uint32 target, const E *e, SolveBuffers &buffers_){
+    uint32 value = e->get_value();
+    uint32 distance = value > target ? value - target : target - value;
+    if (distance < buffers_.best_distance) {
+        buffers_.best_distance = distance;
+        buffers_.best_value = value;
+        buffers_.best_text.clear();
+        e->render(buffers_.best_text);
+        if (!distance) {
+            buffers_.control->stop = true;
+        }
+    }
+}
+
+// simple comparing of target to expression value
+inline void compare(uint32 target, Expression *e, SolveBuffers &buffers_){
+    if (buffers_.stats && e->get_value() == target) {
+        ++buffers_.stats->matches;
+    }
+    if (buffers_.control->mode == MODE_CLOSEST) {
+        compare_closest(target, e, buffers_);
+        return;
+    }
+    if (e->get_value() == target) {
+        // Only the worker that raises stop keeps its first match
+        if (buffers_.control->mode == MODE_FIRST && buffers_.control->stop.exchange(true)) {
+            return;
+        }
+        buffers_.matches.push_back(e);
+    }
+}
+
+// True once the remaining search is not needed anymore
+inline bool stopped(const SolveBuffers &buffers_){
+    return buffers_.control->stop.load(memory_order_relaxed);
+}
+
+// Renders every line that completes the text in line with the items in
+// pending (last item first), choosing each alternative of every node.
+// line and pending are restored after each branch.
+void RenderAlternatives(uint32 target_, SolveBuffers &buffers_){
+    OutputBuffer &line = buffers_.line;
+    vector<SolveBuffers::RenderItem> &pending = buffers_.pending;
+    if (pending.empty()) {
+        buffers_.out.append(line.data(), line.size());
+        buffers_.out.end_line(target_);
+        // One match can stand for a lot of lines
+        if (buffers_.out.size() >= (1 << 16)) {
+            buffers_.sink->write(buffers_.out);
+        }
+        return;
+    }
+
+    SolveBuffers::RenderItem item = pending.back();
+    pending.pop_back();
+    size_t line_size = line.size();
+
+    if (!item.e) {
+        line.append(item.c);
+        RenderAlternatives(target_, buffers_);
+    } else {
+        for(const Expression *e=item.e; e; e=e->get_next_alternative()){
+            if (e->get_op() < 0) {
+                line.append_uint(e->get_value());
+                RenderAlternatives(target_, buffers_);
+                line.truncate(line_size);
+                continue;
+            }
+            size_t pending_size = pending.size();
+            SolveBuffers::RenderItem close = { NULL, ')' };
+            SolveBuffers::RenderItem rhs = { &e->get_rhs(), 0 };
+            SolveBuffers::RenderItem op = { NULL, AllOperators::symbols[e->get_op()] };
+            SolveBuffers::RenderItem lhs = { &e->get_lhs(), 0 };
+            pending.push_back(close);
+            pending.push_back(rhs);
+            pending.push_back(op);
+            pending.push_back(lhs);
+            line.append('(');
+            RenderAlternatives(target_, buffers_);
+            pending.resize(pending_size);
+            line.truncate(line_size);
+        }
+    }
+
+    line.truncate(line_size);
+    pending.push_back(item);
+}
+
+// Renders the recorded matches and hands them to the sink. Must run
+// before the arena holding the matched nodes is released.
+// Shared subtrees are expanded when all solutions are asked for.
+void FlushMatches(uint32 target_, SolveBuffers &buffers_){
+    StatsTimer timer(buffers_.stats ? &buffers_.stats->render_seconds : NULL);
+    bool expand = buffers_.control->hash_cons && buffers_.control->mode == MODE_ALL;
+    for(size_t i=0; i<buffers_.matches.size(); ++i){
+        if (expand) {
+            SolveBuffers::RenderItem root = { buffers_.matches[i], 0 };
+            buffers_.line.clear();
+            buffers_.pending.assign(1, root);
+            RenderAlternatives(target_, buffers_);
+            continue;
+        }
+        buffers_.matches[i]->render(buffers_.out);
+        buffers_.out.end_line(target_);
+    }
+    buffers_.matches.clear();
+    buffers_.sink->write(buffers_.out);
+}
+
+/* Canonical forms, used for distinct solutions. Chains of one operator are
+ * only generated as (a+b)+c, with the terms in descending order:
+ * a+(b+c) and (a+c)+b are skipped, likewise for *, and | is only
+ * generated as (a|b)|c. Subtracted terms are one chain too, a-(b+c) is
+ * generated as (a-b)-c and (a-b)-c only with b >= c, and / the same.
+ * The chains are the operator families of the registry.
+ * These reorderings never make an intermediate value bigger, so the form
+ * kept is valid whenever a skipped one is. Forms that mix an operator with
+ * its inverse, like (a-b)+c and (a+c)-b, are all kept: turning one into
+ * the other can go over max_value, and the solution would be lost.
+ * Terms with equal values are ordered by the signatures of the numbers
+ * they use, which do not depend on which of two equal numbers is used.
+ * Equal numbers themselves are used in source order (see first_copy), so
+ * an expression is generated once, not once per way to pick its numbers.
+ */
+
+// a may come before b in a chain: descending values, then signatures.
+// Equal terms may be in either order, only one of them is generated with
+// the first copies of the numbers.
+inline bool term_before(uint32 a_value_, uint32 a_signature_, uint32 b_value_, uint32 b_signature_){
+    return a_value_ > b_value_ || (a_value_ == b_value_ && a_signature_ >= b_signature_);
+}
+
+inline bool same_family(int op_index_, int other_op_){
+    return other_op_ >= 0 && AllOperators::families[op_index_] != FAMILY_NONE &&
+           AllOperators::families[other_op_] == AllOperators::families[op_index_];
+}
+
+// Rule on the operator of the rhs, -1 for a number:
+// a+(b+c), a-(b+c), a*(b*c)... are folded into the lhs chain. An inverse
+// rhs, as in a+(b-c), is kept.
+inline bool canonical_rhs(int op_index_, int rhs_op_){
+    return !same_family(op_index_, rhs_op_) || (AllOperators::inverse >> rhs_op_ & 1);
+}
+
+// Rules on the lhs, given the value of the rhs. lhs_op_ is -1 for a number.
+// lhs_rhs_* describe the last term of the lhs chain and only matter when
+// lhs_op_ == op_index_.
+inline bool canonical_lhs(int op_index_, int lhs_op_, uint32 lhs_value_, uint32 lhs_signature_,
+                          uint32 lhs_rhs_value_, uint32 lhs_rhs_signature_,
+                          uint32 rhs_value_, uint32 rhs_signature_){
+    // Chain terms in descending order, if their order does not matter
+    if (lhs_op_ == op_index_ && ((AllOperators::commutative | AllOperators::inverse) >> op_index_ & 1)) {
+        return term_before(lhs_rhs_value_, lhs_rhs_signature_, rhs_value_, rhs_signature_);
+    }
+    // Equal operands can be swapped, keep one order
+    return lhs_value_ != rhs_value_ || lhs_signature_ >= rhs_signature_;
+}
+
+inline bool canonical(int op_index_, const Expression &lhs_, const Expression &rhs_){
+    const Expression &lhs_rhs = lhs_.get_rhs();
+    return canonical_rhs(op_index_, rhs_.get_op()) &&
+           canonical_lhs(op_index_, lhs_.get_op(), lhs_.get_value(), lhs_.get_signature(),
+                         lhs_rhs.get_value(), lhs_rhs.get_signature(),
+                         rhs_.get_value(), rhs_.get_signature());
+}
+
+// The number at bit_ may be used: no equal number comes before it in
+// sources_. Every number of an expression is picked from the sources not
+// used by the numbers left of it, so with this rule equal numbers appear
+// in source order, left to right.
+inline bool first_copy(const uint32 *values_, uint32 sources_, uint32 bit_){
+    uint32 value = values_[count_bits(bit_ - 1)];
+    for(uint32 rest=sources_ & (bit_ - 1); rest; rest &= rest - 1){
+        if (values_[count_bits((rest & -rest) - 1)] == value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hash-consing: returns true if e_ is the first node of its key on the
+// counter_ level. Otherwise e_ becomes an alternative of that node and is
+// not combined any further.
+inline bool share_node(Expression *e_, uint32 counter_, SolveBuffers &buffers_){
+    Expression *first = buffers_.shared[counter_].insert(e_, buffers_.control->distinct);
+    if (first) {
+        first->add_alternative(e_);
+    }
+    return !first;
+}
+
+/* Combining kernel: one left value against a block of up to 8 right values,
+ * all operators at once. The operators' valid() rules and left >= right
+ * become lane masks, so no node is created for a pair that is thrown away.
+ * The standard operators have an AVX2 version that is used when the CPU has
+ * it (build with -DCOUNTDOWN_NO_SIMD to leave it out), both give the same
+ * block.
+ */
+const uint32 COMBINE_BLOCK = 8;
+
+// Bit j of valid[op] is set if op is valid for rights[j], the result is
+// in values[op][j]. hits[op] are the valid results equal to the target.
+struct CombineBlock {
+    uint32 values[MAX_OPERATORS][COMBINE_BLOCK];
+    uint32 valid[MAX_OPERATORS];
+    uint32 hits[MAX_OPERATORS];
+};
+
+// Combines the operators in Mask, fixed at compile time. A subset of the
+// standard operators is the whole game; the registry-wide instantiation
+// serves the other games and also skips the operators not in operators_.
+template<uint32 Mask>
+void CombineValuesScalar(uint32 left_, const uint32 *rights_, uint32 count_, uint32 max_value_,
+                         uint32 target_, uint32 operators_, CombineBlock &block_){
+    const bool standard = !(Mask & ~StandardOperators::mask);
+    for(int op=0; op < MAX_OPERATORS; ++op){
+        block_.valid[op] = block_.hits[op] = 0;
+    }
+    for(uint32 j=0; j<count_; ++j){
+        uint32 right = rights_[j];
+        if ((AllOperators::ordered & Mask) == Mask && left_ < right) {
+            continue;
+        }
+        AllOperators::for_each([&](auto op_index, auto op){
+            if constexpr (Mask >> decltype(op_index)::value & 1) {
+                if ((!standard && !(operators_ >> op_index & 1)) ||
+                    !AllOperators::template valid<decltype(op)>(left_, right, max_value_)) {
+                    return;
+                }
+                uint32 value = op.apply(left_, right);
+                block_.values[op_index][j] = value;
+                block_.valid[op_index] |= 1u << j;
+                block_.hits[op_index] |= (value == target_) << j;
+            }
+        });
+    }
+}
+
+#ifdef COUNTDOWN_AVX2
+// Unsigned a <= b for every lane
+__attribute__((target("avx2")))
+inline __m256i lanes_le(__m256i a_, __m256i b_){
+    return _mm256_cmpeq_epi32(_mm256_max_epu32(a_, b_), b_);
+}
+
+// Unsigned lanes as doubles, lo_ selects the lower four
+__attribute__((target("avx2")))
+inline __m256d lanes_to_double(__m256i v_, bool lo_){
+    __m128i half = lo_ ? _mm256_castsi256_si128(v_) : _mm256_extracti128_si256(v_, 1);
+    half = _mm_xor_si128(half, _mm_set1_epi32(0x80000000));
+    return _mm256_add_pd(_mm256_cvtepi32_pd(half), _mm256_set1_pd(2147483648.0));
+}
+
+inline uint32 lane_bits(__m256i mask_) __attribute__((target("avx2")));
+inline uint32 lane_bits(__m256i mask_){
+    return _mm256_movemask_ps(_mm256_castsi256_ps(mask_));
+}
+
+// The standard operators in Mask, only those are computed
+template<uint32 Mask>
+__attribute__((target("avx2")))
+void CombineValuesAvx2(uint32 left_, const uint32 *rights_, uint32 count_, uint32 max_value_,
+                       uint32 target_, uint32, CombineBlock &block_){
+    // Lanes past count_ are padded with 1 and masked out at the end
+    uint32 padded[COMBINE_BLOCK] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+    if (count_ < COMBINE_BLOCK) {
+        copy(rights_, rights_ + count_, padded);
+        rights_ = padded;
+    }
+    __m256i right = _mm256_loadu_si256((const __m256i *)rights_);
+    __m256i left = _mm256_set1_epi32(left_);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i target = _mm256_set1_epi32(target_);
+    uint32 lanes = (1u << count_) - 1;
+    if (left_ > max_value_) {
+        lanes = 0;
+    }
+    lanes &= lane_bits(lanes_le(right, left));
+
+    // The identities and absorbing elements, 0 and 1
+    uint32 not_zero = ~lane_bits(_mm256_cmpeq_epi32(right, zero));
+    uint32 not_one = ~lane_bits(_mm256_cmpeq_epi32(right, one));
+
+    // Same order as StandardOperators
+    const int count = StandardOperators::size;
+    __m256i results[count] = { zero, zero, zero, zero };
+    uint32 ok[count] = { 0, 0, 0, 0 };
+
+    // a+b and a*b within the cap: b <= max-a and b <= max/a
+    if constexpr (Mask >> OpAdd::index & 1) {
+        results[OpAdd::index] = _mm256_add_epi32(left, right);
+        ok[OpAdd::index] = not_zero & lane_bits(lanes_le(right, _mm256_set1_epi32(max_value_ - left_)));
+    }
+
+    if constexpr (Mask >> OpSub::index & 1) {
+        results[OpSub::index] = _mm256_sub_epi32(left, right);
+        ok[OpSub::index] = not_zero & ~lane_bits(_mm256_cmpeq_epi32(left, right));
+    }
+
+    if constexpr (Mask >> OpMult::index & 1) {
+        results[OpMult::index] = _mm256_mullo_epi32(left, right);
+        uint32 mult_limit = left_ ? max_value_ / left_ : ~0u;
+        ok[OpMult::index] = not_zero & not_one & lane_bits(lanes_le(right, _mm256_set1_epi32(mult_limit)));
+    }
+
+    // Quotient in doubles, it is exact when b divides a. Otherwise it can be
+    // one too big, but then q*b differs from a as well.
+    if constexpr (Mask >> OpDivide::index & 1) {
+        __m256d left_d = _mm256_set1_pd(double(left_));
+        __m128i q_lo = _mm256_cvttpd_epi32(_mm256_div_pd(left_d, lanes_to_double(right, true)));
+        __m128i q_hi = _mm256_cvttpd_epi32(_mm256_div_pd(left_d, lanes_to_double(right, false)));
+        __m256i quotient = _mm256_inserti128_si256(_mm256_castsi128_si256(q_lo), q_hi, 1);
+        results[OpDivide::index] = quotient;
+        ok[OpDivide::index] = not_zero & not_one &
+                              lane_bits(_mm256_cmpeq_epi32(_mm256_mullo_epi32(quotient, right), left));
+    }
+
+    for(int op=0; op < MAX_OPERATORS; ++op){
+        block_.valid[op] = block_.hits[op] = 0;
+    }
+    for(int op=0; op < count; ++op){
+        if (!(Mask >> op & 1)) {
+            continue;
+        }
+        _mm256_storeu_si256((__m256i *)block_.values[op], results[op]);
+        block_.valid[op] = ok[op] & lanes;
+        block_.hits[op] = block_.valid[op] & lane_bits(_mm256_cmpeq_epi32(results[op], target));
+    }
+}
+
+inline bool cpu_has_avx2(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+const bool has_avx2 = cpu_has_avx2();
+#endif
+
+// The kernels of every subset of the standard operators, by mask
+template<size_t... Masks>
+void select_standard_kernel(uint32 mask_, combine_values_t &kernel_, index_sequence<Masks...>){
+    static const combine_values_t scalar[] = { CombineValuesScalar<Masks>... };
+    kernel_ = scalar[mask_];
+#ifdef COUNTDOWN_AVX2
+    static const combine_values_t avx2[] = { CombineValuesAvx2<Masks>... };
+    if (has_avx2) {
+        kernel_ = avx2[mask_];
+    }
+#endif
+}
+
+// Each subset of the standard operators gets its own instantiation of the
+// kernels, other games the one for the whole registry
+GameOperators::GameOperators(const string &symbols_):
+    mask(0)
+{
+    for(size_t i=0; i<symbols_.size(); ++i){
+        const char *symbol = strchr(AllOperators::symbols, symbols_[i]);
+        if (symbols_[i] && symbol) {
+            mask |= 1u << (symbol - AllOperators::symbols);
+        }
+    }
+    ordered = !(mask & ~AllOperators::ordered);
+    combine_values = CombineValuesScalar<AllOperators::mask>;
+    if (!(mask & ~StandardOperators::mask)) {
+        select_standard_kernel(mask, combine_values, make_index_sequence<StandardOperators::mask + 1>());
+    }
+}
+
+
+const ExprList
+GenExpressions(uint32 target_, const uint32 *values_, uint32 sources_,
+               uint32 min_rem_sources_, uint32 counter_, SolveBuffers &buffers_);
+
+// Adds the pairs of a block the kernel left out to the prune counts of
+// their rules. Only called with statistics, the kernels do not say why.
+void count_pruned(uint32 left_, const uint32 *rights_, uint32 count_, const GameOperators &operators_,
+                  uint32 max_value_, const CombineBlock &block_, SearchStats &stats_){
+    for(uint32 ops=operators_.mask; ops; ops &= ops - 1){
+        int op = __builtin_ctz(ops);
+        for(uint32 j=0; j<count_; ++j){
+            if (!(block_.valid[op] >> j & 1)) {
+                ++stats_.pruned[AllOperators::prune_rule(op, left_, rights_[j], max_value_)];
+            }
+        }
+    }
+}
+
+// Combines entry lhs_i_ of lhs_list_ with every expression built from its
+// remaining sources. Results are added to the list of the counter_ level,
+// or compared to the target in the outer call.
+void CombineLhs(uint32 target_, const uint32 *values_, const ExprList &lhs_list_, uint32 lhs_i_,
+                uint32 min_rem_sources_, uint32 counter_, SolveBuffers &buffers_)
+{
+    Arena &arena = buffers_.arena;
+    vector<Expression *> &expr_list = buffers_.levels[counter_];
+
+    Expression *lhs_ = lhs_list_.items[lhs_i_];
+    ExprList rhs_list( GenExpressions(target_, values_, lhs_->get_rem_sources(),
+                                      min_rem_sources_, counter_+1, buffers_) );
+    uint32 left = lhs_list_.values[lhs_i_];
+
+    // The outer call of a full search only needs the matches
+    bool hits_only = !counter_ && buffers_.control->mode == MODE_ALL;
+    const GameOperators &operators = buffers_.control->operators;
+    CombineBlock block;
+    StatsTimer timer(buffers_.stats ? &buffers_.stats->combine_seconds : NULL);
+
+    for(uint32 start=0; start < rhs_list.size && !stopped(buffers_); start += COMBINE_BLOCK){
+        // The symmetry and redundancy pruning of the operators is done by
+        // the kernel, see OperatorSet::valid
+        uint32 count = min(COMBINE_BLOCK, rhs_list.size - start);
+        operators.combine_values(left, rhs_list.values + start, count,
+                                 buffers_.control->max_value, target_, operators.mask, block);
+        if (buffers_.stats) {
+            count_pruned(left, rhs_list.values + start, count, operators,
+                         buffers_.control->max_value, block, *buffers_.stats);
+        }
+        const uint32 *keep = hits_only ? block.hits : block.valid;
+        uint32 any = 0;
+        for (int it=0; it < MAX_OPERATORS; ++it){
+            any |= keep[it];
+        }
+
+        for(; any; any &= any - 1){
+            uint32 j = __builtin_ctz(any);
+            Expression *rhs = rhs_list.items[start + j];
+
+            // Iterating through the list of math operators
+            for (int it=0; it < MAX_OPERATORS; ++it){
+                if (!(keep[it] >> j & 1)) {
+                    continue;
+                }
+
+                if (buffers_.control->distinct && !canonical(it, *lhs_, *rhs)) {
+                    if (buffers_.stats) {
+                        ++buffers_.stats->pruned[PRUNE_CANONICAL];
+                    }
+                    continue;
+                }
+
+                // Create new 100% valid expression
+                Expression *res = new (arena) Expression( it, *lhs_, *rhs, block.values[it][j] );
+                ++buffers_.nodes;
+                if (buffers_.stats) {
+                    ++buffers_.stats->depth_nodes[counter_];
+                }
+
+                if(counter_){
+                    if (!buffers_.control->hash_cons || share_node(res, counter_, buffers_)) {
+                        expr_list.push_back(res);
+                    } else if (buffers_.stats) {
+                        ++buffers_.stats->pruned[PRUNE_SHARED];
+                    }
+                    // Every node is a complete expression over some of the
+                    // sources. When one result is enough, check it right away
+                    // instead of waiting for the outer level.
+                    if (buffers_.control->mode != MODE_ALL) {
+                        compare(target_, res, buffers_);
+                    }
+                }else{
+                    compare(target_, res, buffers_);
+                }
+            }
+        }
+    }
+}
+
+
+// The single number bit_ of sources_ as an expression of depth_, or NULL
+// if the game leaves it out: over the cap, or a later copy of an equal
+// number with distinct.
+Expression *NewNumber(const uint32 *values_, uint32 sources_, uint32 bit_, uint32 depth_,
+                      SolveBuffers &buffers_){
+    uint32 value = values_[count_bits(bit_ - 1)];
+    if (value > buffers_.control->max_value ||
+        (buffers_.control->distinct && !first_copy(values_, sources_, bit_))) {
+        return NULL;
+    }
+    Expression *res = new (buffers_.arena) Expression(value, sources_ & ~bit_);
+    ++buffers_.nodes;
+    if (buffers_.stats) {
+        ++buffers_.stats->depth_nodes[depth_];
+    }
+    return res;
+}
+
+
+/* Main function that generates math expressions recursively
+ * target - target number
+ * values - all input numbers
+ * sources - bitmask of the numbers available
+ * min_rem_sources - minimum number of numbers for the expression
+ * counter - Converting generators to usual recursion needs internal
+ *           flag to check recursion level. 
+ * buffers - arena and scratch space for the expressions
+*/
+const ExprList
+GenExpressions(uint32 target_, const uint32 *values_, uint32 sources_,
+               uint32 min_rem_sources_, uint32 counter_, SolveBuffers &buffers_)
+{
+    Arena &arena = buffers_.arena;
+    vector<Expression *> &expr_list = buffers_.levels[counter_];
+    expr_list.clear();
+    if (buffers_.control->hash_cons) {
+        buffers_.shared[counter_].clear();
+    }
+
+    // Generates list of simple expressions from list of numbers
+    for(uint32 rest=sources_; rest; rest &= rest - 1){
+        Expression *res = NewNumber(values_, sources_, rest & -rest, counter_, buffers_);
+        if (!res) {
+            continue;
+        }
+
+        // If we are inside more than one call level then add simple
+        // expressions to the full list
+        if(counter_){
+            expr_list.push_back(res);
+        // We are in the outer function call, we only nedd to compare our expressions to target
+        }else{
+            compare(target_, res, buffers_);
+        }
+    }
+
+    if(count_bits(sources_) >= (min_rem_sources_+2) ) {
+        ExprList lhs_list( GenExpressions(target_, values_, sources_,
+                                          min_rem_sources_+1, counter_+1, buffers_) );
+
+        // Two loops for left and right branches of expression
+        for(uint32 lhs_i=0; lhs_i < lhs_list.size && !stopped(buffers_); ++lhs_i) {
+            CombineLhs(target_, values_, lhs_list, lhs_i,
+                       min_rem_sources_, counter_, buffers_);
+        }
+    }
+
+    ExprList res;
+    res.size = expr_list.size();
+    res.items = (Expression **)arena.allocate(sizeof(Expression *) * res.size);
+    res.values = (uint32 *)arena.allocate(sizeof(uint32) * res.size);
+    for(uint32 i=0; i<res.size; ++i){
+        res.items[i] = expr_list[i];
+        res.values[i] = expr_list[i]->get_value();
+    }
+    return res;
+}
+
+
+// Work-stealing scheduler over task indexes. Every worker owns a deque:
+// it takes tasks from the back of its own one, and when that is empty
+// steals from the front of the others.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(uint32 workers_): queues(workers_) {}
+
+    void push(uint32 worker_, uint32 task_){
+        lock_guard<mutex> guard(queues[worker_].lock);
+        queues[worker_].tasks.push_back(task_);
+    }
+
+    bool pop(uint32 worker_, uint32 &task_){
+        {
+            Queue &own = queues[worker_];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.tasks.empty()) {
+                task_ = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for(uint32 i=1; i<queues.size(); ++i){
+            Queue &victim = queues[(worker_ + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task_ = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs task_fn_(worker, task) until all queues are drained. The calling
+    // thread works as worker 0. No task adds new tasks, so an empty pool
+    // means the work is done.
+    template<class TaskFn>
+    void run(TaskFn task_fn_){
+        vector<thread> threads;
+        for(uint32 w=1; w<queues.size(); ++w){
+            threads.push_back(thread(&WorkStealingPool::work<TaskFn>, this, w, task_fn_));
+        }
+        work(0, task_fn_);
+        for(size_t i=0; i<threads.size(); ++i){
+            threads[i].join();
+        }
+    }
+
+private:
+    template<class TaskFn>
+    void work(uint32 worker_, TaskFn task_fn_){
+        uint32 task;
+        while (pop(worker_, task)) {
+            task_fn_(worker_, task);
+        }
+    }
+
+    struct Queue {
+        mutex lock;
+        deque<uint32> tasks;
+    };
+
+    vector<Queue> queues;
+};
+
+
+// Prints the closest expression found by any of the workers
+void FlushClosest(vector<SolveBuffers> &workers_){
+    size_t best = 0;
+    for(size_t w=1; w<workers_.size(); ++w){
+        if (workers_[w].best_distance < workers_[best].best_distance) {
+            best = w;
+        }
+    }
+    SolveBuffers &buffers = workers_[best];
+    if (buffers.best_distance == ~0u) {
+        return;
+    }
+    buffers.out.append(buffers.best_text.data(), buffers.best_text.size());
+    buffers.out.end_line(buffers.best_value);
+    buffers.sink->write(buffers.out);
+}
+
+
+void SolveWorkers(uint32 target_, const vector<uint32> &sources_, vector<SolveBuffers> &workers_);
+
+// Where the search time of buffers_ goes, NULL without statistics
+inline double *search_seconds(SolveBuffers &buffers_){
+    return buffers_.stats ? &buffers_.stats->search_seconds : NULL;
+}
+
+// Prints all expressions for target_ (or the closest one, see
+// SearchControl), then releases the nodes in one go.
+// With more than one worker buffer the iterations over the top-level lhs
+// list are spread over threads; workers_[0] is the calling thread.
+void Solve(uint32 target_, const vector<uint32> &sources_, vector<SolveBuffers> &workers_){
+    // Recursion is never deeper than the number of sources. Sized up front,
+    // so references into levels stay valid during the recursion.
+    for(size_t w=0; w<workers_.size(); ++w){
+        if (workers_[w].levels.size() <= sources_.size()) {
+            workers_[w].levels.resize(sources_.size() + 1);
+            workers_[w].shared.resize(sources_.size() + 1);
+        }
+        // Nodes are at most sources_.size() - 1 levels deep: every level
+        // down has fewer sources left over the ones the expression must use
+        SearchStats *stats = workers_[w].stats;
+        if (stats && stats->depth_nodes.size() < sources_.size()) {
+            stats->depth_nodes.resize(sources_.size());
+        }
+        workers_[w].best_distance = ~0u;
+    }
+
+    SolveWorkers(target_, sources_, workers_);
+
+    if (workers_[0].control->mode == MODE_CLOSEST) {
+        FlushClosest(workers_);
+    }
+}
+
+// The list of GenExpressions(target_, values_, sources_, 1, 1), built by
+// all workers: the combinations of every entry of the lhs list one level
+// deeper are a task. The nodes are in the arenas of the workers that made
+// them, the list itself in the main arena.
+ExprList ParallelLhsList(uint32 target_, const uint32 *values_, uint32 sources_,
+                         vector<SolveBuffers> &workers_){
+    SolveBuffers &main_buffers = workers_[0];
+    const SearchControl &control = *main_buffers.control;
+    for(size_t w=0; w<workers_.size(); ++w){
+        workers_[w].levels[1].clear();
+        if (control.hash_cons) {
+            workers_[w].shared[1].clear();
+        }
+    }
+
+    ExprList deeper = ExprList();
+    {
+        StatsTimer timer(search_seconds(main_buffers));
+        for(uint32 rest=sources_; rest; rest &= rest - 1){
+            Expression *res = NewNumber(values_, sources_, rest & -rest, 1, main_buffers);
+            if (res) {
+                main_buffers.levels[1].push_back(res);
+            }
+        }
+        if (count_bits(sources_) >= 3) {
+            deeper = GenExpressions(target_, values_, sources_, 2, 2, main_buffers);
+        }
+        FlushMatches(target_, main_buffers);
+    }
+
+    WorkStealingPool pool(workers_.size());
+    for(uint32 i=deeper.size; i-- > 0; ){
+        pool.push(i % workers_.size(), i);
+    }
+    pool.run([&](uint32 worker_, uint32 task_){
+        SolveBuffers &buffers = workers_[worker_];
+        if (stopped(buffers)) {
+            return;
+        }
+        StatsTimer timer(search_seconds(buffers));
+        CombineLhs(target_, values_, deeper, task_, 1, 1, buffers);
+        FlushMatches(target_, buffers);
+    });
+
+    // Every worker shared the nodes it made, the shared nodes of the other
+    // workers become alternatives of those of the main one
+    uint32 size = 0;
+    for(size_t w=0; w<workers_.size(); ++w){
+        size += workers_[w].levels[1].size();
+    }
+    ExprList res;
+    res.size = 0;
+    res.items = (Expression **)main_buffers.arena.allocate(sizeof(Expression *) * size);
+    res.values = (uint32 *)main_buffers.arena.allocate(sizeof(uint32) * size);
+    for(size_t w=0; w<workers_.size(); ++w){
+        const vector<Expression *> &level = workers_[w].levels[1];
+        for(size_t i=0; i<level.size(); ++i){
+            if (w && control.hash_cons) {
+                Expression *first = main_buffers.shared[1].insert(level[i], control.distinct);
+                if (first) {
+                    first->add_alternative(level[i]);
+                    continue;
+                }
+            }
+            res.items[res.size] = level[i];
+            res.values[res.size] = level[i]->get_value();
+            ++res.size;
+        }
+    }
+    return res;
+}
+
+void SolveWorkers(uint32 target_, const vector<uint32> &sources_, vector<SolveBuffers> &workers_){
+    uint32 all_sources = sources_.size() < 32 ? (uint32(1) << sources_.size()) - 1 : ~uint32(0);
+    const uint32 *values = &sources_[0];
+    SolveBuffers &main_buffers = workers_[0];
+
+    if (workers_.size() == 1) {
+        StatsTimer timer(search_seconds(main_buffers));
+        GenExpressions(target_, values, all_sources, 0, 0, main_buffers);
+        FlushMatches(target_, main_buffers);
+        main_buffers.arena.reset();
+        return;
+    }
+
+    // Same as the outer GenExpressions call, with the lhs loop in parallel
+    {
+        StatsTimer timer(search_seconds(main_buffers));
+        for(uint32 rest=all_sources; rest; rest &= rest - 1){
+            Expression *single = NewNumber(values, all_sources, rest & -rest, 0, main_buffers);
+            if (single) {
+                compare(target_, single, main_buffers);
+            }
+        }
+        if (sources_.size() < 2) {
+            FlushMatches(target_, main_buffers);
+            main_buffers.arena.reset();
+            return;
+        }
+    }
+    ExprList lhs_list = ParallelLhsList(target_, values, all_sources, workers_);
+
+    // Each worker releases its subtrees after every task, and only rewinds
+    // past the lhs nodes in its arena.
+    // Round-robin keeps the big early tasks on different workers, and every
+    // worker starts from the front of its share.
+    WorkStealingPool pool(workers_.size());
+    for(uint32 i=lhs_list.size; i-- > 0; ){
+        pool.push(i % workers_.size(), i);
+    }
+    vector<Arena::Mark> marks;
+    for(size_t w=0; w<workers_.size(); ++w){
+        marks.push_back(workers_[w].arena.mark());
+    }
+    pool.run([&](uint32 worker_, uint32 task_){
+        SolveBuffers &buffers = workers_[worker_];
+        if (stopped(buffers)) {
+            return;
+        }
+        StatsTimer timer(search_seconds(buffers));
+        CombineLhs(target_, values, lhs_list, task_, 0, 0, buffers);
+        FlushMatches(target_, buffers);
+        buffers.arena.rewind(marks[worker_]);
+    });
+    for(size_t w=0; w<workers_.size(); ++w){
+        workers_[w].arena.reset();
+    }
+}
+
+
+/* Bounded-memory enumeration: the same expressions as GenExpressions, but
+ * produced one at a time by a tree of cursors instead of being collected
+ * in per-level lists. The current expression of a cursor is a number, or
+ * an operator over the current expressions of its lhs and rhs cursors, so
+ * nothing is stored per expression. Memory only depends on the number of
+ * sources, at most one cursor per node of the deepest expression tree.
+ */
+class ExpressionCursor {
+public:
+    ExpressionCursor(): op_index(-1), phase(PHASE_DONE), lhs(NULL), rhs(NULL) {}
+    ~ExpressionCursor(){
+        delete lhs;
+        delete rhs;
+    }
+
+    // Expressions over sources_ leaving at least min_rem_sources_ of them
+    void start(uint32 sources_, uint32 min_rem_sources_){
+        sources = sources_;
+        rest = sources_;
+        min_rem_sources = min_rem_sources_;
+        phase = PHASE_NUMBERS;
+    }
+
+    // Moves to the next expression, false once there are no more. The
+    // order is the one of GenExpressions: numbers first, then for every
+    // lhs all rhs and operators.
+    bool next(const uint32 *values_, const SearchControl &control_, unsigned long &nodes_){
+        for(;;){
+            switch (phase) {
+            case PHASE_NUMBERS:
+                while (rest) {
+                    uint32 bit = rest & -rest;
+                    rest &= rest - 1;
+                    value = values_[count_bits(bit - 1)];
+                    if (value > control_.max_value ||
+                        (control_.distinct && !first_copy(values_, sources, bit))) {
+                        continue;
+                    }
+                    op_index = -1;
+                    remaining_mask = sources & ~bit;
+                    signature = number_signature(value);
+                    ++nodes_;
+                    return true;
+                }
+                if (count_bits(sources) < min_rem_sources + 2) {
+                    phase = PHASE_DONE;
+                    return false;
+                }
+                if (!lhs) {
+                    lhs = new ExpressionCursor;
+                    rhs = new ExpressionCursor;
+                }
+                lhs->start(sources, min_rem_sources + 1);
+                phase = PHASE_LHS;
+                break;
+
+            case PHASE_LHS:
+                if (!lhs->next(values_, control_, nodes_)) {
+                    phase = PHASE_DONE;
+                    return false;
+                }
+                rhs->start(lhs->remaining_mask, min_rem_sources);
+                phase = PHASE_RHS;
+                break;
+
+            case PHASE_RHS:
+                if (!rhs->next(values_, control_, nodes_)) {
+                    phase = PHASE_LHS;
+                    break;
+                }
+                // Same symmetry optimization as in CombineLhs
+                if (control_.operators.ordered && lhs->value < rhs->value) {
+                    break;
+                }
+                op_index = -1;
+                phase = PHASE_OPERATORS;
+                break;
+
+            case PHASE_OPERATORS:
+                // The operators of the game after op_index
+                for(uint32 rest = control_.operators.mask & (~0u << (op_index + 1)); rest;
+                    rest &= rest - 1){
+                    op_index = __builtin_ctz(rest);
+                    if (!control_.operators.combine(op_index, lhs->value, rhs->value,
+                                                    control_.max_value, value)) {
+                        continue;
+                    }
+                    if (control_.distinct && !canonical()) {
+                        continue;
+                    }
+                    remaining_mask = rhs->remaining_mask;
+                    signature = lhs->signature + rhs->signature;
+                    ++nodes_;
+                    return true;
+                }
+                phase = PHASE_RHS;
+                break;
+
+            case PHASE_DONE:
+                return false;
+            }
+        }
+    }
+
+    uint32 get_value() const {return value;}
+    void render(OutputBuffer &out_) const {
+        if (op_index < 0) { out_.append_uint( value ); }
+        else {
+            out_.append('(');
+            lhs->render(out_);
+            out_.append(AllOperators::symbols[op_index]);
+            rhs->render(out_);
+            out_.append(')');
+        }
+    }
+
+private:
+    enum Phase {
+        PHASE_NUMBERS,      // single numbers, rest still to go
+        PHASE_LHS,          // next lhs, rhs cursor restarts
+        PHASE_RHS,          // next rhs for the current lhs
+        PHASE_OPERATORS,    // operators after op_index for lhs and rhs
+        PHASE_DONE
+    };
+
+    // The canonical form rules for op_index over the current lhs and rhs
+    bool canonical() const {
+        if (!canonical_rhs(op_index, rhs->op_index)) {
+            return false;
+        }
+        uint32 lhs_rhs_value = 0, lhs_rhs_signature = 0;
+        if (lhs->op_index >= 0) {
+            lhs_rhs_value = lhs->rhs->value;
+            lhs_rhs_signature = lhs->rhs->signature;
+        }
+        return canonical_lhs(op_index, lhs->op_index, lhs->value, lhs->signature,
+                             lhs_rhs_value, lhs_rhs_signature, rhs->value, rhs->signature);
+    }
+
+    // Current expression
+    uint32 value;
+    int op_index;
+    uint32 remaining_mask;
+    uint32 signature;
+
+    uint32 sources;
+    uint32 rest;
+    uint32 min_rem_sources;
+    Phase phase;
+    ExpressionCursor *lhs;
+    ExpressionCursor *rhs;
+
+    ExpressionCursor(const ExpressionCursor &);
+    ExpressionCursor &operator=(const ExpressionCursor &);
+};
+
+// Every expression over sources_, in the order of GenExpressions. The
+// cursor is only valid until the next one is asked for. Expressions
+// enumerated are added to *nodes_ if it is given.
+Generator<const ExpressionCursor *>
+Expressions(vector<uint32> sources_, bool distinct_ = false, uint32 max_value_ = ~0u,
+            unsigned long *nodes_ = NULL, string operators_ = "+-*/")
+{
+    SearchControl control;
+    control.distinct = distinct_;
+    control.max_value = max_value_;
+    control.operators = GameOperators(operators_);
+    unsigned long nodes = 0;
+    if (!nodes_) {
+        nodes_ = &nodes;
+    }
+
+    uint32 all_sources = sources_.size() < 32 ? (uint32(1) << sources_.size()) - 1 : ~uint32(0);
+    ExpressionCursor root;
+    root.start(all_sources, 0);
+    while (root.next(sources_.data(), control, *nodes_)) {
+        co_yield &root;
+    }
+}
+
+// Same output as Solve, but expressions are enumerated by cursors and
+// rendered as soon as they match. Runs on the first worker only.
+void SolveStream(uint32 target_, const vector<uint32> &sources_, vector<SolveBuffers> &workers_){
+    for(size_t w=0; w<workers_.size(); ++w){
+        workers_[w].best_distance = ~0u;
+    }
+    SolveBuffers &buffers = workers_[0];
+    SearchControl &control = *buffers.control;
+
+    if (control.mode == MODE_CLOSEST) {
+        for (const ExpressionCursor *e : Expressions(sources_, control.distinct, control.max_value,
+                                                     &buffers.nodes, control.operators.symbols())) {
+            compare_closest(target_, e, buffers);
+            if (stopped(buffers)) {
+                break;
+            }
+        }
+        FlushClosest(workers_);
+        return;
+    }
+
+    // The expressions rather than Solutions, so a cancel is seen even
+    // while nothing matches
+    for (const ExpressionCursor *e : Expressions(sources_, control.distinct, control.max_value,
+                                                 &buffers.nodes, control.operators.symbols())) {
+        if (stopped(buffers)) {
+            break;
+        }
+        if (e->get_value() != target_) {
+            continue;
+        }
+        e->render(buffers.out);
+        buffers.out.end_line(target_);
+        if (control.mode == MODE_FIRST) {
+            break;
+        }
+        if (buffers.out.size() >= (1 << 16)) {
+            buffers.sink->write(buffers.out);
+        }
+    }
+    buffers.sink->write(buffers.out);
+}
+
+/* Memoized solver: instead of re-enumerating the same sub-multiset of
+ * numbers over and over, every subset of the sources (an index bitmask)
+ * gets one table with all distinct values reachable from it. Each value
+ * keeps back-pointers to the (lhs, rhs) entries of the two disjoint subsets
+ * it was built from, so all expressions can be listed afterwards. The same
+ * pruning rules as in GenExpressions apply, thus the solution set is equal.
+ */
+
+// One way to build a value: op applied to entries of two subset tables.
+// Source numbers have op_index -1.
+struct Derivation {
+    int op_index;
+    uint32 lhs_mask;
+    uint32 lhs_entry;
+    uint32 rhs_mask;
+    uint32 rhs_entry;
+};
+
+// Distinct values reachable from one subset, sorted ascending.
+// Derivations of values[i] are derivations[first[i]] .. derivations[first[i+1]-1]
+struct SubsetTable {
+    uint32 signature;
+    vector<uint32> values;
+    vector<uint32> first;
+    vector<Derivation> derivations;
+};
+
+struct Candidate {
+    uint32 value;
+    Derivation derivation;
+};
+
+inline bool candidate_less(const Candidate &a, const Candidate &b){
+    return a.value < b.value;
+}
+
+
+// Memory held by the tables of one subset
+inline size_t table_bytes(const SubsetTable &t_){
+    return sizeof(SubsetTable) + t_.values.capacity() * sizeof(uint32) +
+           t_.first.capacity() * sizeof(uint32) + t_.derivations.capacity() * sizeof(Derivation);
+}
+
+/* LRU cache of the memo tables of whole draws, keyed by the sorted numbers
+ * so the order they are given in does not matter, and the game (see
+ * SubsetSolver::load). Tables are moved in and out by swapping vectors,
+ * nothing is copied. Entries are evicted, least recently used first, while
+ * the cache holds more than max_bytes. Solvers on several threads can
+ * share one cache.
+ */
+class TableCache {
+public:
+    TableCache(): max_bytes(0), hits(0), misses(0), bytes(0) {}
+
+    // Moves the tables of key_ into tables_, removing them from the cache;
+    // false if they are not cached
+    bool take(const vector<uint32> &key_, vector<SubsetTable> &tables_){
+        lock_guard<mutex> guard(lock);
+        map<vector<uint32>, list<Entry>::iterator>::iterator it = index.find(key_);
+        if (it == index.end()) {
+            ++misses;
+            return false;
+        }
+        ++hits;
+        tables_.swap(it->second->tables);
+        bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+        return true;
+    }
+
+    // Moves tables_ of key_ into the cache as the most recently used
+    // entry. tables_ gets the memory of an evicted entry, if there is one,
+    // for the next build.
+    void put(const vector<uint32> &key_, vector<SubsetTable> &tables_){
+        size_t size = sizeof(Entry) + key_.size() * sizeof(uint32) +
+                      tables_.capacity() * sizeof(SubsetTable);
+        for(size_t i=0; i<tables_.size(); ++i){
+            size += table_bytes(tables_[i]);
+        }
+        lock_guard<mutex> guard(lock);
+        if (size > max_bytes || index.count(key_)) {
+            return;
+        }
+        entries.push_front(Entry());
+        entries.front().key = key_;
+        entries.front().bytes = size;
+        entries.front().tables.swap(tables_);
+        index[key_] = entries.begin();
+        bytes += size;
+
+        while (bytes > max_bytes) {
+            Entry &last = entries.back();
+            tables_.swap(last.tables);
+            bytes -= last.bytes;
+            index.erase(last.key);
+            entries.pop_back();
+        }
+    }
+
+    size_t max_bytes;
+    atomic<unsigned long> hits;
+    atomic<unsigned long> misses;
+
+private:
+    // Guards everything below
+    mutex lock;
+    size_t bytes;
+
+    struct Entry {
+        vector<uint32> key;
+        size_t bytes;
+        vector<SubsetTable> tables;
+    };
+
+    // Most recently used first
+    list<Entry> entries;
+    map<vector<uint32>, list<Entry>::iterator> index;
+};
+
+class SubsetSolver {
+public:
+    SubsetSolver(): complete(false), distinct(false), max_value(~0u), stop(NULL), nodes(0) {}
+
+    // Fill tables for all subsets. Every proper submask of a mask is
+    // numerically smaller, so increasing order visits children first.
+    // Tables of the previous build are cleared but keep their memory.
+    // A cancelled build leaves the tables incomplete, and everything that
+    // reads them stops as well.
+    void build(const vector<uint32> &sources_){
+        start(sources_);
+        uint32 full = (uint32(1) << sources.size()) - 1;
+        for(uint32 mask=1; mask<=full && !cancelled(); ++mask){
+            build_table(mask);
+        }
+        complete = !cancelled();
+    }
+
+    // Tables of sources_ in ascending order, from cache_ if they are there,
+    // built otherwise. store() hands them back. The key has the operators
+    // and the cap too, tables of other games are different.
+    void load(const vector<uint32> &sources_, TableCache &cache_){
+        vector<uint32> sorted(sources_);
+        sort(sorted.begin(), sorted.end());
+        cache_key = sorted;
+        cache_key.push_back(operators.mask);
+        cache_key.push_back(max_value);
+        if (cache_.take(cache_key, tables)) {
+            start(sorted);
+            complete = true;
+        } else {
+            build(sorted);
+        }
+    }
+
+    // Incomplete tables are not kept
+    void store(TableCache &cache_){
+        if (complete) {
+            cache_.put(cache_key, tables);
+        }
+    }
+
+    // Builds tables while tracking the value nearest to target_, stops
+    // at the first exact hit and prints one expression for that value.
+    // With exact_only_ nothing is printed unless the target is reached.
+    void print_closest(const vector<uint32> &sources_, uint32 target_, bool exact_only_,
+                       SolutionSink &sink_){
+        start(sources_);
+        closest(target_, exact_only_, true, sink_);
+    }
+
+    // The same over the tables of build or load
+    void print_closest_built(uint32 target_, bool exact_only_, SolutionSink &sink_){
+        closest(target_, exact_only_, false, sink_);
+    }
+
+    // Print every expression equal to target_, from every subset
+    void print_matches(uint32 target_, SolutionSink &sink_){
+        uint32 full = (uint32(1) << sources.size()) - 1;
+        for(uint32 mask=1; mask<=full && !cancelled(); ++mask){
+            const SubsetTable &t = tables[mask];
+            vector<uint32>::const_iterator v = lower_bound(t.values.begin(), t.values.end(), target_);
+            if (v == t.values.end() || *v != target_ || (distinct && !first_copies(mask, full))) {
+                continue;
+            }
+            RenderItem root = { mask, uint32(v - t.values.begin()), 0, -1, false, 0, 0 };
+            pending.push_back(root);
+            line.clear();
+            lines_left = ~0u;
+            render_all(target_, sink_);
+            pending.clear();
+        }
+        sink_.write(out);
+    }
+
+    // Prints one expression for every value in [min_value_, max_value_]
+    // reachable from the sources of build or load, from a subset with as
+    // few numbers as possible.
+    void print_reachable(uint32 min_value_, uint32 max_value_, SolutionSink &sink_){
+        uint32 full = (uint32(1) << sources.size()) - 1;
+        reached.assign(max_value_ - min_value_ + 1, false);
+        for(uint32 bits=1; bits<=sources.size(); ++bits){
+            for(uint32 mask=1; mask<=full && !cancelled(); ++mask){
+                if (count_bits(mask) != bits) {
+                    continue;
+                }
+                const vector<uint32> &values = tables[mask].values;
+                vector<uint32>::const_iterator v = lower_bound(values.begin(), values.end(), min_value_);
+                for(; v != values.end() && *v <= max_value_; ++v){
+                    if (reached[*v - min_value_]) {
+                        continue;
+                    }
+                    reached[*v - min_value_] = true;
+                    RenderItem root = { mask, uint32(v - values.begin()), 0, -1, false, 0, 0 };
+                    pending.push_back(root);
+                    line.clear();
+                    lines_left = 1;
+                    render_all(*v, sink_);
+                    pending.clear();
+                }
+            }
+        }
+        sink_.write(out);
+    }
+
+    // Meet in the middle: prints the same as build and print_matches, but
+    // the table of all sources, by far the biggest one, is never built.
+    // Expressions over all sources are found by joining the tables of
+    // complementary subsets: for every lhs value the rhs value that gives
+    // target_ is looked up in the other table.
+    void print_matches_joined(const vector<uint32> &sources_, uint32 target_, SolutionSink &sink_){
+        start(sources_);
+        uint32 full = (uint32(1) << sources.size()) - 1;
+        for(uint32 mask=1; mask<full && !cancelled(); ++mask){
+            build_table(mask);
+        }
+        if (full == 1) {
+            build_table(full);
+        } else {
+            clear_table(full);
+        }
+        print_matches(target_, sink_);
+
+        lines_left = ~0u;
+        for(uint32 lhs_mask=(full-1) & full; lhs_mask && full != 1 && !cancelled();
+            lhs_mask=(lhs_mask-1) & full){
+            uint32 rhs_mask = full ^ lhs_mask;
+            if (distinct && !first_copies(lhs_mask, full)) {
+                continue;
+            }
+            const vector<uint32> &lhs_values = tables[lhs_mask].values;
+            const vector<uint32> &rhs_values = tables[rhs_mask].values;
+
+            for(uint32 i=0; i<lhs_values.size(); ++i){
+                uint32 left = lhs_values[i];
+                for (int op=0; op < MAX_OPERATORS; ++op){
+                    if (!(operators.mask >> op & 1)) {
+                        continue;
+                    }
+                    uint32 right, value;
+                    // Without a unique right operand every rhs value is tried
+                    if (!(AllOperators::unique_right >> op & 1)) {
+                        for(uint32 j=0; j<rhs_values.size(); ++j){
+                            if (operators.combine(op, left, rhs_values[j], max_value, value) &&
+                                value == target_) {
+                                Derivation d = { op, lhs_mask, i, rhs_mask, j };
+                                print_derivation(d, target_, sink_);
+                            }
+                        }
+                        continue;
+                    }
+                    if (!AllOperators::right_operand(op, left, target_, right) ||
+                        !operators.combine(op, left, right, max_value, value) || value != target_) {
+                        continue;
+                    }
+                    vector<uint32>::const_iterator v = lower_bound(rhs_values.begin(), rhs_values.end(), right);
+                    if (v == rhs_values.end() || *v != right) {
+                        continue;
+                    }
+                    Derivation d = { op, lhs_mask, i, rhs_mask, uint32(v - rhs_values.begin()) };
+                    print_derivation(d, target_, sink_);
+                }
+            }
+        }
+        sink_.write(out);
+    }
+
+private:
+    // True once the solve is cancelled, see Solver::cancel
+    bool cancelled() const {
+        return stop && stop->load(memory_order_relaxed);
+    }
+
+    void start(const vector<uint32> &sources_){
+        sources = sources_;
+        if (tables.size() < (size_t(1) << sources.size())) {
+            tables.resize(size_t(1) << sources.size());
+        }
+    }
+
+    // Prints the expressions of d_, a derivation of target_ over all sources
+    void print_derivation(const Derivation &d_, uint32 target_, SolutionSink &sink_){
+        ++nodes;
+        line.clear();
+        push_operands(d_);
+        render_all(target_, sink_);
+        pending.clear();
+    }
+
+    // Tracks the value nearest to target_ over the tables, built on the
+    // way with build_, and prints one expression for it
+    void closest(uint32 target_, bool exact_only_, bool build_, SolutionSink &sink_){
+        uint32 full = (uint32(1) << sources.size()) - 1;
+        uint32 best_distance = ~0u, best_mask = 0, best_entry = 0;
+        for(uint32 mask=1; mask<=full && best_distance && !cancelled(); ++mask){
+            if (build_) {
+                build_table(mask);
+            }
+
+            // Nearest values are around the insertion point of target_
+            const vector<uint32> &values = tables[mask].values;
+            size_t i = lower_bound(values.begin(), values.end(), target_) - values.begin();
+            for(size_t k=(i ? i-1 : i); k<=i && k<values.size(); ++k){
+                uint32 distance = values[k] > target_ ? values[k] - target_ : target_ - values[k];
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best_mask = mask;
+                    best_entry = k;
+                }
+            }
+        }
+        if (!best_mask || (exact_only_ && best_distance)) {
+            return;
+        }
+        RenderItem root = { best_mask, best_entry, 0, -1, false, 0, 0 };
+        pending.push_back(root);
+        line.clear();
+        lines_left = 1;
+        render_all(tables[best_mask].values[best_entry], sink_);
+        pending.clear();
+        sink_.write(out);
+    }
+
+    // A table without values
+    void clear_table(uint32 mask){
+        SubsetTable &t = tables[mask];
+        t.values.clear();
+        t.first.assign(1, 0);
+        t.derivations.clear();
+    }
+
+    void build_table(uint32 mask){
+        SubsetTable &t = tables[mask];
+        t.values.clear();
+        t.first.clear();
+        t.derivations.clear();
+
+        // Single source number
+        if ( (mask & (mask-1)) == 0 ) {
+            Derivation d = {-1, 0, 0, 0, 0};
+            uint32 value = sources[count_bits(mask - 1)];
+            t.signature = number_signature(value);
+            t.first.push_back(0);
+            if (value > max_value) {
+                return;
+            }
+            t.values.push_back(value);
+            t.first.push_back(1);
+            t.derivations.push_back(d);
+            ++nodes;
+            return;
+        }
+
+        uint32 low_bit = mask & (~mask + 1);
+        t.signature = tables[low_bit].signature + tables[mask ^ low_bit].signature;
+
+        candidates.clear();
+        CombineBlock block;
+        // Iterate all ordered splits of mask into two non-empty parts
+        for(uint32 lhs_mask=(mask-1) & mask; lhs_mask && !cancelled(); lhs_mask=(lhs_mask-1) & mask){
+            uint32 rhs_mask = mask ^ lhs_mask;
+            const vector<uint32> &lhs_values = tables[lhs_mask].values;
+            const vector<uint32> &rhs_values = tables[rhs_mask].values;
+
+            for(uint32 i=0; i<lhs_values.size(); ++i){
+                uint32 left = lhs_values[i];
+                // Same symmetry optimization as in GenExpressions: left >= right,
+                // rhs values are sorted so the block ends at the first bigger one
+                uint32 rhs_count = rhs_values.size();
+                if (operators.ordered) {
+                    rhs_count = upper_bound(rhs_values.begin(), rhs_values.end(), left) -
+                                rhs_values.begin();
+                }
+                for(uint32 start=0; start<rhs_count; start+=COMBINE_BLOCK){
+                    operators.combine_values(left, &rhs_values[start],
+                                             min(COMBINE_BLOCK, rhs_count - start),
+                                             max_value, 0, operators.mask, block);
+                    uint32 any = 0;
+                    for (int op=0; op < MAX_OPERATORS; ++op){
+                        any |= block.valid[op];
+                    }
+                    for(; any; any &= any - 1){
+                        uint32 j = __builtin_ctz(any);
+                        for (int op=0; op < MAX_OPERATORS; ++op){
+                            if (!(block.valid[op] >> j & 1)) {
+                                continue;
+                            }
+                            Candidate c = { block.values[op][j],
+                                            {op, lhs_mask, i, rhs_mask, start + j} };
+                            candidates.push_back(c);
+                        }
+                    }
+                }
+            }
+        }
+
+        nodes += candidates.size();
+
+        // Group equal values, keeping the generation order of derivations
+        stable_sort(candidates.begin(), candidates.end(), candidate_less);
+        t.derivations.reserve(candidates.size());
+        for(size_t i=0; i<candidates.size(); ++i){
+            if (i == 0 || candidates[i].value != candidates[i-1].value) {
+                t.values.push_back(candidates[i].value);
+                t.first.push_back(i);
+            }
+            t.derivations.push_back(candidates[i].derivation);
+        }
+        t.first.push_back(candidates.size());
+    }
+
+    // Either a table entry still to be expanded, or a single char when
+    // mask is 0. For distinct output an entry also knows the operator it is
+    // an operand of (-1 for the root), its side and the value and signature
+    // of its rhs sibling, to check the canonical form rules.
+    struct RenderItem {
+        uint32 mask;
+        uint32 entry;
+        char c;
+        int parent_op;
+        bool is_rhs;
+        uint32 sibling_value;
+        uint32 sibling_signature;
+    };
+
+    // part_ of mask_ holds the first copies in mask_ of its numbers, see
+    // first_copy: equal numbers are split in source order
+    bool first_copies(uint32 part_, uint32 mask_) const {
+        for(uint32 rest=part_; rest; rest &= rest - 1){
+            uint32 bit = rest & -rest;
+            if (!first_copy(&sources[0], (mask_ & ~part_) | bit, bit)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether derivation d_ of item_ can be part of a canonical form
+    bool canonical_choice(const RenderItem &item_, const Derivation &d_) const {
+        if (d_.op_index >= 0 && !first_copies(d_.lhs_mask, item_.mask)) {
+            return false;
+        }
+        if (item_.parent_op < 0) {
+            return true;
+        }
+        if (item_.is_rhs) {
+            return canonical_rhs(item_.parent_op, d_.op_index);
+        }
+        uint32 rhs_value = d_.op_index < 0 ? 0 : tables[d_.rhs_mask].values[d_.rhs_entry];
+        return canonical_lhs(item_.parent_op, d_.op_index, tables[item_.mask].values[item_.entry],
+                             tables[item_.mask].signature, rhs_value, tables[d_.rhs_mask].signature,
+                             item_.sibling_value, item_.sibling_signature);
+    }
+
+    // Starts rendering derivation d_: "(" goes to line, its operands,
+    // operator and the closing bracket to pending
+    void push_operands(const Derivation &d_){
+        uint32 right = tables[d_.rhs_mask].values[d_.rhs_entry];
+        RenderItem close = { 0, 0, ')', -1, false, 0, 0 };
+        RenderItem rhs = { d_.rhs_mask, d_.rhs_entry, 0, d_.op_index, true, 0, 0 };
+        RenderItem op = { 0, 0, AllOperators::symbols[d_.op_index], -1, false, 0, 0 };
+        RenderItem lhs = { d_.lhs_mask, d_.lhs_entry, 0, d_.op_index, false, right,
+                           tables[d_.rhs_mask].signature };
+        pending.push_back(close);
+        pending.push_back(rhs);
+        pending.push_back(op);
+        pending.push_back(lhs);
+        line.append('(');
+    }
+
+    // Renders every line that completes the text in line with the items
+    // in pending (last item first), at most lines_left of them. An entry
+    // with several derivations branches, line and pending are restored
+    // after each branch.
+    void render_all(uint32 target_, SolutionSink &sink_){
+        if (!lines_left) {
+            return;
+        }
+        if (pending.empty()) {
+            out.append(line.data(), line.size());
+            out.end_line(target_);
+            --lines_left;
+            return;
+        }
+
+        RenderItem item = pending.back();
+        pending.pop_back();
+        size_t line_size = line.size();
+
+        if (!item.mask) {
+            line.append(item.c);
+            render_all(target_, sink_);
+        } else {
+            const SubsetTable &t = tables[item.mask];
+            for(uint32 k=t.first[item.entry]; k<t.first[item.entry+1]; ++k){
+                const Derivation &d = t.derivations[k];
+                if (distinct && !canonical_choice(item, d)) {
+                    continue;
+                }
+                if (d.op_index < 0) {
+                    line.append_uint(t.values[item.entry]);
+                    render_all(target_, sink_);
+                    line.truncate(line_size);
+                    continue;
+                }
+                size_t pending_size = pending.size();
+                push_operands(d);
+                render_all(target_, sink_);
+                pending.resize(pending_size);
+                line.truncate(line_size);
+            }
+        }
+
+        line.truncate(line_size);
+        pending.push_back(item);
+    }
+
+    vector<uint32> sources;
+    vector<SubsetTable> tables;
+    // The tables hold every subset, they can be cached
+    bool complete;
+    vector<uint32> cache_key;
+    vector<Candidate> candidates;
+    // Values of print_reachable already printed
+    vector<bool> reached;
+
+    // Rendering state: text of the current line, items still to render
+    // and the finished lines
+    OutputBuffer line;
+    vector<RenderItem> pending;
+    SolutionLines out;
+    uint32 lines_left;
+
+public:
+    // Render canonical forms only
+    bool distinct;
+    // Values above it are pruned, see OpAdd::domain
+    uint32 max_value;
+    GameOperators operators;
+    // Raised to cancel, NULL if it cannot be
+    const atomic<bool> *stop;
+
+public:
+    // Derivations created by all builds
+    unsigned long nodes;
+};
+
+
+} // namespace
+
+
+const char *const OPERATOR_SYMBOLS = AllOperators::symbols;
+
+Generator<Solution>
+Solutions(uint32 target_, vector<uint32> sources_, bool distinct_, uint32 max_value_,
+          unsigned long *nodes_, string operators_)
+{
+    OutputBuffer text;
+    Solution solution;
+    solution.value = target_;
+    for (const ExpressionCursor *e : Expressions(sources_, distinct_, max_value_, nodes_, operators_)) {
+        if (e->get_value() != target_) {
+            continue;
+        }
+        text.clear();
+        e->render(text);
+        solution.expression.assign(text.data(), text.size());
+        co_yield solution;
+    }
+}
+
+struct SolverCache::State {
+    TableCache cache;
+};
+
+SolverCache::SolverCache(size_t max_bytes_):
+    state(new State)
+{
+    state->cache.max_bytes = max_bytes_;
+}
+
+SolverCache::~SolverCache(){
+    delete state;
+}
+
+// Memory of all solvers, kept warm between puzzles
+struct Solver::State {
+    State(const SolverOptions &options_):
+        algorithm(options_.algorithm),
+        running(false),
+        workers(options_.threads ? options_.threads : 1),
+        collect_stats(options_.stats),
+        worker_stats(workers.size()),
+        seconds(0)
+    {
+        control.mode = options_.mode;
+        control.distinct = options_.distinct;
+        control.hash_cons = options_.hash_cons;
+        control.max_value = options_.max_value;
+        subsets.max_value = options_.max_value;
+        subsets.distinct = options_.distinct;
+        control.operators = subsets.operators = GameOperators(options_.operators);
+        own_cache.max_bytes = options_.cache_bytes;
+        cache = options_.cache ? &options_.cache->state->cache :
+                options_.cache_bytes ? &own_cache : NULL;
+        subsets.stop = &control.stop;
+        sink.set_count_only(options_.count_only);
+        for(size_t w=0; w<workers.size(); ++w){
+            workers[w].sink = &sink;
+            workers[w].control = &control;
+            if (collect_stats) {
+                workers[w].stats = &worker_stats[w];
+            }
+        }
+    }
+
+    // From here on a cancel ends the solve, see Solver::cancel
+    void begin_solve(){
+        lock_guard<mutex> guard(lock);
+        control.stop = false;
+        running = true;
+    }
+
+    void end_solve(){
+        lock_guard<mutex> guard(lock);
+        running = false;
+    }
+
+    Algorithm algorithm;
+    // Guards control.stop between solves
+    mutex lock;
+    bool running;
+    SearchControl control;
+    SolutionSink sink;
+    SubsetSolver subsets;
+    // own_cache, a shared one or NULL
+    TableCache *cache;
+    TableCache own_cache;
+    vector<SolveBuffers> workers;
+    bool collect_stats;
+    vector<SearchStats> worker_stats;
+    // Wall time of the solves, with collect_stats
+    double seconds;
+};
+
+Solver::Solver(const SolverOptions &options_):
+    state(new State(options_))
+{}
+
+Solver::~Solver(){
+    delete state;
+}
+
+unsigned long Solver::nodes() const {
+    unsigned long res = state->subsets.nodes;
+    for(size_t w=0; w<state->workers.size(); ++w){
+        res += state->workers[w].nodes;
+    }
+    return res;
+}
+
+unsigned long Solver::cache_hits() const {
+    return state->cache ? state->cache->hits.load() : 0;
+}
+
+unsigned long Solver::cache_misses() const {
+    return state->cache ? state->cache->misses.load() : 0;
+}
+
+SearchStats Solver::stats() const {
+    SearchStats res;
+    if (!state->collect_stats) {
+        return res;
+    }
+    res.nodes = nodes();
+    res.seconds = state->seconds;
+    for(size_t w=0; w<state->worker_stats.size(); ++w){
+        const SearchStats &stats = state->worker_stats[w];
+        if (res.depth_nodes.size() < stats.depth_nodes.size()) {
+            res.depth_nodes.resize(stats.depth_nodes.size());
+        }
+        for(size_t d=0; d<stats.depth_nodes.size(); ++d){
+            res.depth_nodes[d] += stats.depth_nodes[d];
+        }
+        for(int r=0; r<PRUNE_RULES; ++r){
+            res.pruned[r] += stats.pruned[r];
+        }
+        res.matches += stats.matches;
+        res.search_seconds += stats.search_seconds;
+        res.combine_seconds += stats.combine_seconds;
+        res.render_seconds += stats.render_seconds;
+    }
+    return res;
+}
+
+void Solver::cancel(){
+    lock_guard<mutex> guard(state->lock);
+    if (state->running) {
+        state->control.stop = true;
+    }
+}
+
+unsigned long Solver::solve_targets(uint32 min_target_, uint32 max_target_,
+                                    const vector<uint32> &numbers_,
+                                    const SolutionCallback &callback_){
+    if (numbers_.empty() || numbers_.size() > MAX_TABLE_NUMBERS || min_target_ > max_target_) {
+        return 0;
+    }
+    StatsTimer timer(state->collect_stats ? &state->seconds : NULL);
+    state->sink.start_solve(&callback_);
+    state->begin_solve();
+    if (state->cache) {
+        state->subsets.load(numbers_, *state->cache);
+        state->subsets.print_reachable(min_target_, max_target_, state->sink);
+        state->subsets.store(*state->cache);
+    } else {
+        state->subsets.build(numbers_);
+        state->subsets.print_reachable(min_target_, max_target_, state->sink);
+    }
+    state->end_solve();
+    return state->sink.solutions();
+}
+
+unsigned long Solver::solve(uint32 target_, const vector<uint32> &numbers_,
+                            const SolutionCallback &callback_){
+    if (numbers_.empty() || numbers_.size() > 32) {
+        return 0;
+    }
+    SearchControl &control = state->control;
+    SubsetSolver &subsets = state->subsets;
+    SolutionSink &sink = state->sink;
+
+    StatsTimer timer(state->collect_stats ? &state->seconds : NULL);
+    sink.start_solve(&callback_);
+    state->begin_solve();
+    // Too many numbers for a table per subset go to the recursion
+    bool tables = numbers_.size() <= MAX_TABLE_NUMBERS;
+    if (state->cache && tables) {
+        // Whole tables of the sorted numbers, whatever the algorithm is
+        subsets.load(numbers_, *state->cache);
+        if (control.mode == MODE_ALL) {
+            subsets.print_matches(target_, sink);
+        } else {
+            subsets.print_closest_built(target_, control.mode == MODE_FIRST, sink);
+        }
+        subsets.store(*state->cache);
+    } else if (tables && (state->algorithm == ALGO_MEMO || state->algorithm == ALGO_MITM) &&
+               control.mode != MODE_ALL) {
+        // Stops building tables at the first hit, no join needed
+        subsets.print_closest(numbers_, target_, control.mode == MODE_FIRST, sink);
+    } else if (tables && state->algorithm == ALGO_MEMO) {
+        subsets.build(numbers_);
+        subsets.print_matches(target_, sink);
+    } else if (tables && state->algorithm == ALGO_MITM) {
+        subsets.print_matches_joined(numbers_, target_, sink);
+    } else if (state->algorithm == ALGO_STREAM) {
+        SolveStream(target_, numbers_, state->workers);
+    } else {
+        Solve(target_, numbers_, state->workers);
+    }
+    state->end_solve();
+    return sink.solutions();
+}